@@ -8,11 +8,17 @@
 #include <QPlainTextEdit>
 #include <QLabel>
 #include <QPushButton>
-#include <QRegularExpression>
-#include <QRegularExpressionMatch>
-#include <utility>
+#include <QFile>
+#include <QFileDialog>
+#include <QMessageBox>
+#include <QProgressDialog>
+#include <QTextStream>
+#include <QTimer>
+#include <QThread>
 
 #include "affixerdialog.h"
+#include "affixgenerator.h"
+#include "affixpreviewthread.h"
 
 AffixerDialog::AffixerDialog(QWidget *parent) : QDialog(parent)
 {
@@ -67,9 +73,17 @@ AffixerDialog::AffixerDialog(QWidget *parent) : QDialog(parent)
     m_overwritetext = new QPushButton("Replace text");
     m_bottomlayout->addWidget(m_overwritetext);
 
+    m_saveWordList = new QPushButton("Save as word list...");
+    m_bottomlayout->addWidget(m_saveWordList);
+
     m_layout->addLayout(m_toplayout);
     m_layout->addLayout(m_bottomlayout);
 
+    m_previewTimer = new QTimer(this);
+    m_previewTimer->setSingleShot(true);
+    m_previewTimer->setInterval(300);
+    connect(m_previewTimer, &QTimer::timeout, this, &AffixerDialog::startPreview);
+
     connect(m_prefixes, &QPlainTextEdit::textChanged, this, &AffixerDialog::textEntered);
     connect(m_roots, &QPlainTextEdit::textChanged, this, &AffixerDialog::textEntered);
     connect(m_infixes, &QPlainTextEdit::textChanged, this, &AffixerDialog::textEntered);
@@ -78,137 +92,124 @@ AffixerDialog::AffixerDialog(QWidget *parent) : QDialog(parent)
     connect(m_addToStart, &QPushButton::clicked, this, &AffixerDialog::emitAddTextToStart);
     connect(m_addAtCursor, &QPushButton::clicked, this, &AffixerDialog::emitAddTextAtCursor);
     connect(m_overwritetext, &QPushButton::clicked, this, &AffixerDialog::emitOverwriteText);
+    connect(m_saveWordList, &QPushButton::clicked, this, &AffixerDialog::saveWordList);
+}
+
+AffixerDialog::~AffixerDialog()
+{
+    // a preview which is still being generated has to stop before its thread is destroyed
+    for (AffixPreviewThread *preview : findChildren<AffixPreviewThread *>())
+    {
+        preview->Cancel();
+        preview->wait();
+    }
 }
 
+// The preview is only updated once typing pauses, and any preview still being generated is out of date
 void AffixerDialog::textEntered()
 {
-    m_preview->setPlainText(this->GetWords().join('\n'));
+    if (m_previewRun)
+    {
+        disconnect(m_previewRun, 0, this, 0);
+        m_previewRun->Cancel();
+        m_previewRun = nullptr;
+    }
+    m_previewTimer->start();
+}
+
+void AffixerDialog::startPreview()
+{
+    m_previewRun = new AffixPreviewThread(m_roots->toPlainText(), m_prefixes->toPlainText(), m_infixes->toPlainText(), m_suffixes->toPlainText(), previewLimit, this);
+    connect(m_previewRun, &AffixPreviewThread::previewReady, this, &AffixerDialog::showPreview);
+    connect(m_previewRun, &QThread::finished, m_previewRun, &QObject::deleteLater);
+    m_previewRun->start();
+}
+
+void AffixerDialog::showPreview(QStringList words, quint64 total)
+{
+    m_previewRun = nullptr;
+    m_preview->setPlainText(words.join('\n'));
+    if (total > quint64(words.length())) m_previewlabel->setText(QString("Preview (first %1 of %2):").arg(words.length()).arg(total));
+    else                                 m_previewlabel->setText(QString("Preview (%1):").arg(total));
 }
 
 void AffixerDialog::emitAddTextToEnd()
 {
-    emit addText(this->GetWords(), PlaceToAdd::AddToEnd);
+    emitAddText(PlaceToAdd::AddToEnd);
 }
 
 void AffixerDialog::emitAddTextToStart()
 {
-    emit addText(this->GetWords(), PlaceToAdd::AddToStart);
+    emitAddText(PlaceToAdd::AddToStart);
 }
 
 void AffixerDialog::emitAddTextAtCursor()
 {
-    emit addText(this->GetWords(), PlaceToAdd::AddAtCursor);
+    emitAddText(PlaceToAdd::AddAtCursor);
 }
 
 void AffixerDialog::emitOverwriteText()
 {
-    emit addText(this->GetWords(), PlaceToAdd::Overwrite);
+    emitAddText(PlaceToAdd::Overwrite);
 }
 
-QStringList AffixerDialog::GetWords()
+// The text box needs every word in memory several times over, so tables which are too big for it are streamed to a
+// word list instead, which is then opened as a mapped lexicon
+void AffixerDialog::emitAddText(PlaceToAdd placeToAdd)
 {
-    QStringList words;
-    QStringList roots = m_roots->toPlainText().split('\n', QString::SkipEmptyParts);
-
-    QList<QStringList> prefixSlots = GetSlotAffixes(m_prefixes->toPlainText().split('\n', QString::SkipEmptyParts));
-    QList<QStringList> infixSlots  = GetSlotAffixes(m_infixes ->toPlainText().split('\n', QString::SkipEmptyParts));
-    QList<QStringList> suffixSlots = GetSlotAffixes(m_suffixes->toPlainText().split('\n', QString::SkipEmptyParts));
-
-    QList<QStringList> prefixcombs = CartesianProduct(prefixSlots);
-    QList<QStringList> infixcombs  = CartesianProduct(infixSlots);
-    QList<QStringList> suffixcombs = CartesianProduct(suffixSlots);
-
-    QList<int> infixnums;
-    for (QStringList infixSlot : infixSlots)
-    {
-        for (QString infix : infixSlot)
-        {
-            QRegularExpressionMatch match = QRegularExpression(R"re(^(\d+)(.*)$)re").match(infix);
-            int num = match.captured(1).toInt();
-            if (!infixnums.contains(num)) infixnums.append(num);
-        }
-    }
-    for (QString root : roots)
+    AffixGenerator generator = Generator();
+    quint64 count = generator.Count();
+    if (count > quint64(textLimit))
     {
-        for (QStringList prefixcomb : prefixcombs)
-        {
-            for (QStringList infixcomb : infixcombs)
-            {
-                QList<std::pair<int, QString>> infixes;
-                for (QString infix : infixcomb)
-                {
-                    QRegularExpressionMatch match = QRegularExpression(R"re(^(\d+)(.*)$)re").match(infix);
-                    if (match.hasMatch())
-                    {
-                        int num = match.captured(1).toInt();
-                        infixes.append(std::make_pair(num, match.captured(2)));
-                    }
-                }
-
-                for (QStringList suffixcomb : suffixcombs)
-                {
-                    QString word(root);
-                    for (std::pair<int, QString> infix : infixes)
-                    {
-                        word = word.replace(QString::number(infix.first), infix.second);
-                    }
-
-                    for (int infixnum : infixnums)
-                    {
-                        word = word.replace(QString::number(infixnum), "");
-                    }
-
-                    word = prefixcomb.join("").append(word);
-                    word = word.append(suffixcomb.join(""));
-                    words.append(word);
-                }
-            }
-        }
+        QString question = QString("These affixes make %1 words, which is too many to add to the text box. Save them as a word list and open that instead?").arg(count);
+        if (QMessageBox::question(this, "Too Many Words", question) == QMessageBox::Yes) saveWordList();
+        return;
     }
 
-    return words;
+    QStringList words;
+    words.reserve(int(count));
+    QString word;
+    while (generator.Next(word)) words.append(word);
+    emit addText(words, placeToAdd);
 }
 
-QList<QStringList> AffixerDialog::GetSlotAffixes(QStringList affixGroups)
+AffixGenerator AffixerDialog::Generator()
 {
-    QList<QStringList> result;
-    for (QString slot : affixGroups)
-    {
-        QStringList affixes;
-        QStringList splitSlots = slot.split(' ', QString::SkipEmptyParts);
-        for (QString affix : splitSlots)
-        {
-            affixes.append((affix == "*") ? "" : affix);
-        }
-        result.append(affixes);
-    }
-    return result;
+    return AffixGenerator(m_roots->toPlainText(), m_prefixes->toPlainText(), m_infixes->toPlainText(), m_suffixes->toPlainText());
 }
 
-QList<QStringList> AffixerDialog::CartesianProduct(QList<QStringList> sequences)
+// Writes the words straight to a file as they are generated, so tables too big to hold in memory can still be used
+void AffixerDialog::saveWordList()
 {
-    if (sequences.count() == 0) return QList<QStringList>();
+    QString fileName = QFileDialog::getSaveFileName(this, "Save Word List", QString(), "exSCA word files (*.lex);;All files (*.*)");
+    if (fileName.isEmpty()) return;
 
-    QList<QStringList> result;
-    for (QString s : sequences.at(0))
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
     {
-        result.append({ QStringList(s) });
+        QMessageBox::warning(this, "Could Not Save File", "The file could not be opened for writing");
+        return;
     }
+    QTextStream out(&file);
+    out.setCodec("UTF-8");
 
-    for (int i = 1; i < sequences.count(); i++)
+    AffixGenerator generator = Generator();
+    quint64 count = generator.Count();
+    QProgressDialog progress("Saving words...", "Cancel", 0, 100, this);
+    progress.setWindowModality(Qt::WindowModal);
+
+    QString word;
+    for (quint64 i = 0; generator.Next(word); i++)
     {
-        QList<QStringList> temp;
-        for (QStringList sl : result)
+        out << word << '\n';
+        if (i % 65536 == 0)
         {
-            for (QString s : sequences.at(i))
-            {
-                QStringList tempStrList = QStringList(sl);
-                tempStrList.append(s);
-                temp.append(tempStrList);
-            }
+            progress.setValue(int(i * 100 / count));
+            if (progress.wasCanceled()) break;
         }
-        result = QList<QStringList>(temp);
     }
+    progress.setValue(100);
+    file.close();
 
-    return result;
-}
\ No newline at end of file
+    if (!progress.wasCanceled()) emit wordListSaved(fileName);
+}
@@ -12,8 +12,9 @@ class QHBoxLayout;
 class QPlainTextEdit;
 class QLabel;
 class QPushButton;
-
-template <class T> class QList;
+class QTimer;
+class AffixGenerator;
+class AffixPreviewThread;
 
 class AffixerDialog : public QDialog
 {
@@ -21,6 +22,7 @@ class AffixerDialog : public QDialog
 
 public:
     explicit AffixerDialog(QWidget *parent = 0);
+    ~AffixerDialog();
 
     enum class PlaceToAdd
     {
@@ -32,13 +34,17 @@ public:
 
 signals:
     void addText(QStringList words, PlaceToAdd placeToAdd);
+    void wordListSaved(QString fileName);
 
 private slots:
     void textEntered();
+    void startPreview();
+    void showPreview(QStringList words, quint64 total);
     void emitAddTextToStart();
     void emitAddTextToEnd();
     void emitAddTextAtCursor();
     void emitOverwriteText();
+    void saveWordList();
 
 private:
     QVBoxLayout *m_layout;
@@ -61,10 +67,15 @@ private:
     QPushButton *m_addToEnd;
     QPushButton *m_addAtCursor;
     QPushButton *m_overwritetext;
+    QPushButton *m_saveWordList;
+
+    static const int previewLimit = 1000;   // the most words shown in the preview
+    static const int textLimit = 1 << 20;   // the most words added to the text box; more have to be saved as a word list
+    QTimer *m_previewTimer;
+    AffixPreviewThread *m_previewRun = nullptr;     // the preview being generated, if there is one
 
-    QStringList GetWords();
-    QList<QStringList> GetSlotAffixes(QStringList slots);
-    QList<QStringList> CartesianProduct(QList<QStringList> sequences);
+    void emitAddText(PlaceToAdd placeToAdd);
+    AffixGenerator Generator();
 };
 
 #endif
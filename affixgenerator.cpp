@@ -0,0 +1,152 @@
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QRegularExpression>
+#include <QRegularExpressionMatch>
+#include <algorithm>
+#include <limits>
+#include <utility>
+#include "affixgenerator.h"
+
+AffixGenerator::AffixGenerator(const QString &roots, const QString &prefixes, const QString &infixes, const QString &suffixes)
+{
+    static const QRegularExpression infixPattern(R"re(^(\d+)(.*)$)re");
+
+    m_prefixSlots = ParseSlots(prefixes);
+    m_suffixSlots = ParseSlots(suffixes);
+
+    QStringList infixNumbers;       // every number used by any infix, as it is written in the roots
+    for (const QStringList &slot : ParseSlots(infixes))
+    {
+        QVector<std::pair<int, QString>> parsed;
+        for (const QString &infix : slot)
+        {
+            QRegularExpressionMatch match = infixPattern.match(infix);
+            int number = match.hasMatch() ? match.captured(1).toInt() : -1;
+            parsed.append(std::make_pair(number, match.captured(2)));
+            if (match.hasMatch() && !infixNumbers.contains(QString::number(number))) infixNumbers.append(QString::number(number));
+        }
+        m_infixSlots.append(parsed);
+    }
+
+    // longer numbers are looked for first, so '12' isn't taken as '1' followed by '2'
+    std::sort(infixNumbers.begin(), infixNumbers.end(), [](const QString &a, const QString &b) { return a.length() > b.length(); });
+    for (const QString &text : roots.split('\n', QString::SkipEmptyParts))
+    {
+        Root root;
+        QString piece;
+        for (int i = 0; i < text.length();)
+        {
+            auto number = std::find_if(infixNumbers.constBegin(), infixNumbers.constEnd(), [&](const QString &n) { return text.midRef(i, n.length()) == n; });
+            if (number == infixNumbers.constEnd())
+            {
+                piece.append(text.at(i++));
+                continue;
+            }
+            root.pieces.append(piece);
+            root.positions.append(number->toInt());
+            piece.clear();
+            i += number->length();
+        }
+        root.pieces.append(piece);
+        m_roots.append(root);
+    }
+
+    m_prefixSizes = Sizes(m_prefixSlots);
+    m_infixSizes = Sizes(m_infixSlots);
+    m_suffixSizes = Sizes(m_suffixSlots);
+    Reset();
+}
+
+QVector<QStringList> AffixGenerator::ParseSlots(const QString &text)
+{
+    QVector<QStringList> result;
+    for (const QString &line : text.split('\n', QString::SkipEmptyParts))
+    {
+        QStringList affixes;
+        for (const QString &affix : line.split(' ', QString::SkipEmptyParts)) affixes.append(affix == "*" ? QString() : affix);
+        result.append(affixes);
+    }
+    return result;
+}
+
+template <typename T>
+QVector<int> AffixGenerator::Sizes(const QVector<T> &affixSlots)
+{
+    QVector<int> sizes;
+    for (const T &slot : affixSlots) sizes.append(slot.length());
+    return sizes;
+}
+
+quint64 AffixGenerator::Count() const
+{
+    // there are no words at all if any kind of affix has no slots, or any slot has no affixes
+    if (m_prefixSlots.isEmpty() || m_infixSlots.isEmpty() || m_suffixSlots.isEmpty()) return 0;
+
+    // a table with more words than a quint64 can hold is counted as the largest one there is
+    const quint64 most = std::numeric_limits<quint64>::max();
+    quint64 count = quint64(m_roots.length());
+    auto multiply = [&count, most](int size)
+    {
+        if (size != 0 && count > most / quint64(size)) count = most;
+        else count *= quint64(size);
+    };
+    for (int size : m_prefixSizes) multiply(size);
+    for (int size : m_infixSizes)  multiply(size);
+    for (int size : m_suffixSizes) multiply(size);
+    return count;
+}
+
+void AffixGenerator::Reset()
+{
+    m_root = 0;
+    m_prefixIndex.fill(0, m_prefixSlots.length());
+    m_infixIndex.fill(0, m_infixSlots.length());
+    m_suffixIndex.fill(0, m_suffixSlots.length());
+    m_done = Count() == 0;
+}
+
+// Moves index on to the next combination, with the last slot changing fastest. Returns false once every
+// combination has been used, leaving index back at the first.
+bool AffixGenerator::Advance(QVector<int> &index, const QVector<int> &sizes)
+{
+    for (int slot = index.length() - 1; slot >= 0; slot--)
+    {
+        if (++index[slot] < sizes.at(slot)) return true;
+        index[slot] = 0;
+    }
+    return false;
+}
+
+bool AffixGenerator::Next(QString &word)
+{
+    if (m_done) return false;
+
+    word.clear();
+    for (int slot = 0; slot < m_prefixSlots.length(); slot++) word.append(m_prefixSlots.at(slot).at(m_prefixIndex.at(slot)));
+
+    // each infix position gets the first infix with its number, or nothing if none of them have it
+    const Root &root = m_roots.at(m_root);
+    for (int i = 0; i < root.positions.length(); i++)
+    {
+        word.append(root.pieces.at(i));
+        for (int slot = 0; slot < m_infixSlots.length(); slot++)
+        {
+            const std::pair<int, QString> &infix = m_infixSlots.at(slot).at(m_infixIndex.at(slot));
+            if (infix.first == root.positions.at(i))
+            {
+                word.append(infix.second);
+                break;
+            }
+        }
+    }
+    word.append(root.pieces.last());
+
+    for (int slot = 0; slot < m_suffixSlots.length(); slot++) word.append(m_suffixSlots.at(slot).at(m_suffixIndex.at(slot)));
+
+    if (!Advance(m_suffixIndex, m_suffixSizes) && !Advance(m_infixIndex, m_infixSizes) && !Advance(m_prefixIndex, m_prefixSizes))
+    {
+        m_done = ++m_root >= m_roots.length();
+    }
+    return true;
+}
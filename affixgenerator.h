@@ -0,0 +1,57 @@
+#ifndef AFFIXGENERATOR_H
+#define AFFIXGENERATOR_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <utility>
+
+// Generates every combination of a root with one affix from each prefix, infix and suffix slot, one word at a
+// time, so even tables with millions of forms never have to be held in memory. Words come out in the same order as
+// nested loops over the roots, prefixes, infixes and suffixes, with the last slot changing fastest.
+class AffixGenerator
+{
+public:
+    // Each argument has one item per line. Each line of prefixes, infixes and suffixes is a slot, with its affixes
+    // seperated by spaces and '*' for no affix. Infixes are written as the number in the root they replace
+    // followed by the infix, as in '1a'.
+    AffixGenerator(const QString &roots, const QString &prefixes, const QString &infixes, const QString &suffixes);
+
+    // The exact number of words, worked out from the sizes of the slots without generating them, or the largest
+    // quint64 if there are more than that
+    quint64 Count() const;
+
+    // Sets word to the next word, or returns false if there are none left
+    bool Next(QString &word);
+
+    // Starts again from the first word
+    void Reset();
+
+private:
+    // A root split at its infix positions, which are found once instead of for every combination
+    struct Root
+    {
+        QStringList pieces;         // the text around the infix positions; there is always one more than positions
+        QVector<int> positions;     // the infix number at each position
+    };
+
+    QVector<Root> m_roots;
+    QVector<QStringList> m_prefixSlots;
+    QVector<QVector<std::pair<int, QString>>> m_infixSlots;     // (number, infix); the number is -1 if it isn't valid
+    QVector<QStringList> m_suffixSlots;
+    QVector<int> m_prefixSizes;
+    QVector<int> m_infixSizes;
+    QVector<int> m_suffixSizes;
+
+    int m_root;
+    QVector<int> m_prefixIndex;
+    QVector<int> m_infixIndex;
+    QVector<int> m_suffixIndex;
+    bool m_done;
+
+    static QVector<QStringList> ParseSlots(const QString &text);
+    static bool Advance(QVector<int> &index, const QVector<int> &sizes);
+    template <typename T> static QVector<int> Sizes(const QVector<T> &affixSlots);
+};
+
+#endif // AFFIXGENERATOR_H
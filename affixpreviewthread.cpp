@@ -0,0 +1,35 @@
+#include <QThread>
+#include <QString>
+#include <QStringList>
+#include <QAtomicInt>
+#include "affixpreviewthread.h"
+#include "affixgenerator.h"
+
+AffixPreviewThread::AffixPreviewThread(const QString &roots, const QString &prefixes, const QString &infixes, const QString &suffixes, int limit, QObject *parent) :
+    QThread(parent),
+    m_roots(roots),
+    m_prefixes(prefixes),
+    m_infixes(infixes),
+    m_suffixes(suffixes),
+    m_limit(limit),
+    m_cancelled(0)
+{
+}
+
+void AffixPreviewThread::Cancel()
+{
+    m_cancelled.storeRelease(1);
+}
+
+void AffixPreviewThread::run()
+{
+    AffixGenerator generator(m_roots, m_prefixes, m_infixes, m_suffixes);
+    QStringList words;
+    QString word;
+    while (words.length() < m_limit && generator.Next(word))
+    {
+        if (m_cancelled.loadAcquire()) return;
+        words.append(word);
+    }
+    if (!m_cancelled.loadAcquire()) emit previewReady(words, generator.Count());
+}
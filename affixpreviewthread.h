@@ -0,0 +1,36 @@
+#ifndef AFFIXPREVIEWTHREAD_H
+#define AFFIXPREVIEWTHREAD_H
+
+#include <QThread>
+#include <QString>
+#include <QStringList>
+#include <QAtomicInt>
+
+// Generates the start of the Affixer's word list in the background, so typing in the dialog isn't held up by big
+// tables. Only the first few words are generated; the total is worked out from the sizes of the slots.
+class AffixPreviewThread : public QThread
+{
+    Q_OBJECT
+
+public:
+    AffixPreviewThread(const QString &roots, const QString &prefixes, const QString &infixes, const QString &suffixes, int limit, QObject *parent = 0);
+
+    // Stops generating words; previewReady() isn't emitted
+    void Cancel();
+
+signals:
+    void previewReady(QStringList words, quint64 total);
+
+protected:
+    void run() override;
+
+private:
+    QString m_roots;
+    QString m_prefixes;
+    QString m_infixes;
+    QString m_suffixes;
+    int m_limit;
+    QAtomicInt m_cancelled;
+};
+
+#endif // AFFIXPREVIEWTHREAD_H
@@ -0,0 +1,102 @@
+#include <QChar>
+#include <QString>
+#include <QMap>
+#include <QList>
+#include <QVector>
+#include <QHash>
+#include "categorytable.h"
+
+CategoryTable::CategoryTable() : m_version(0), m_slots(0x10000, -1)
+{
+}
+
+CategoryTable::CategoryTable(const QMap<QChar, QList<QChar>> &categories, const QString &rules) : m_version(0), m_slots(0x10000, -1)
+{
+    QString contents;           // used to compute m_version
+    for (auto it = categories.constBegin(); it != categories.constEnd(); ++it)
+    {
+        contents.append(it.key()).append('=');
+        int slot = m_members.length();
+        m_slots[it.key().unicode()] = slot;
+
+        QString members;
+        for (int i = 0; i < it.value().length(); i++)
+        {
+            QChar phoneme = it.value().at(i);
+            members.append(phoneme);
+
+            // if a phoneme occurs twice in a category, the first occurrence is the one which counts
+            quint32 key = (quint32(slot) << 16) | phoneme.unicode();
+            if (!m_memberIndices.contains(key)) m_memberIndices.insert(key, i);
+        }
+        m_members.append(members);
+        contents.append(members).append('\n');
+    }
+    m_version = qHash(contents);
+
+    int start = rules.indexOf('[');
+    while (start >= 0)
+    {
+        int end = rules.indexOf(']', start);
+        if (end < 0) break;
+        QStringRef nonce = rules.midRef(start + 1, end - start - 1);
+        uint hash = qHash(nonce);
+        if (!m_nonceIndices.contains(hash))
+        {
+            m_nonceIndices.insert(hash, m_nonces.length());
+            m_nonces.append(std::make_pair(nonce.toString(), ComputeNonce(nonce)));
+        }
+        start = rules.indexOf('[', end);
+    }
+}
+
+int CategoryTable::IndexOf(QChar category, QChar phoneme) const
+{
+    int slot = m_slots.at(category.unicode());
+    if (slot < 0) return -1;
+    return m_memberIndices.value((quint32(slot) << 16) | phoneme.unicode(), -1);
+}
+
+const QString &CategoryTable::Members(QChar category) const
+{
+    static const QString empty;
+    int slot = m_slots.at(category.unicode());
+    if (slot < 0) return empty;
+    return m_members.at(slot);
+}
+
+CategoryTable::Nonce CategoryTable::ParseNonce(const QStringRef &nonce) const
+{
+    auto it = m_nonceIndices.constFind(qHash(nonce));
+    if (it != m_nonceIndices.constEnd() && m_nonces.at(it.value()).first == nonce) return m_nonces.at(it.value()).second;
+    return ComputeNonce(nonce);
+}
+
+CategoryTable::Nonce CategoryTable::ComputeNonce(const QStringRef &nonce) const
+{
+    QString beforeTilde, afterTilde;
+    bool hasTildeOcurred = false;
+
+    for (int i = 0; i < nonce.length(); i++)
+    {
+        QChar c = nonce.at(i);
+        if (c == '~')
+        {
+            hasTildeOcurred = true;
+            continue;
+        }
+
+        QString &chars = hasTildeOcurred ? afterTilde : beforeTilde;
+        if (IsCategory(c)) chars.append(Members(c));
+        else               chars.append(c);
+    }
+
+    Nonce result;
+    result.positive = beforeTilde.length() != 0;
+    for (QChar c : beforeTilde)
+    {
+        if (afterTilde.contains(c)) continue;
+        result.members.append(c);
+    }
+    return result;
+}
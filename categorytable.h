@@ -0,0 +1,52 @@
+#ifndef CATEGORYTABLE_H
+#define CATEGORYTABLE_H
+
+#include <QString>
+#include <QVector>
+#include <QHash>
+#include <utility>
+
+class QChar;
+template <class Key, class T> class QMap;
+template <class T> class QList;
+
+// An immutable, flattened copy of the categories, built once per run and shared by reference
+// between all the matching functions in SoundChanges
+class CategoryTable
+{
+public:
+    struct Nonce
+    {
+        QString members;        // the characters matched by the nonce category, with categories expanded
+        bool positive;          // false for nonce categories of the form '[~...]', which match anything except their members
+    };
+
+    CategoryTable();
+
+    // rules is scanned for nonce categories ('[...]') so they can be parsed in advance
+    CategoryTable(const QMap<QChar, QList<QChar>> &categories, const QString &rules = QString());
+
+    bool IsCategory(QChar c) const { return m_slots.at(c.unicode()) >= 0; }
+
+    // Returns the index of phoneme in category, or -1 if it is not a member
+    int IndexOf(QChar category, QChar phoneme) const;
+
+    const QString &Members(QChar category) const;
+
+    Nonce ParseNonce(const QStringRef &nonce) const;
+
+    // Identifies the contents of the table, so anything cached against it stays valid while the categories are unchanged
+    uint Version() const { return m_version; }
+
+private:
+    uint m_version;
+    QVector<qint16> m_slots;                    // maps every BMP character to its index in m_members, or -1 if it isn't a category
+    QVector<QString> m_members;
+    QHash<quint32, int> m_memberIndices;        // maps (slot << 16 | phoneme) to the index of phoneme in the category
+    QVector<std::pair<QString, Nonce>> m_nonces;
+    QHash<uint, int> m_nonceIndices;            // maps the hash of a nonce to its index in m_nonces, so it can be looked up without making a QString
+
+    Nonce ComputeNonce(const QStringRef &nonce) const;
+};
+
+#endif // CATEGORYTABLE_H
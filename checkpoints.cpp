@@ -0,0 +1,114 @@
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QByteArray>
+#include <QMap>
+#include <QMutex>
+#include <QAtomicInteger>
+#include <QAtomicInt>
+#include "checkpoints.h"
+#include "trace.h"
+
+Checkpoints::Checkpoints(qint64 budget) :
+    m_budget(budget)
+{
+}
+
+Checkpoints::~Checkpoints()
+{
+    qDeleteAll(m_boundaries);
+    qDeleteAll(m_recording);
+}
+
+int Checkpoints::Begin(const QStringList &rules, const QByteArray &state, int wordCount)
+{
+    if (!m_inUse.tryLock()) return -1;
+
+    // nothing recorded before can be used if anything other than the rules has changed
+    if (state != m_state || wordCount != m_wordCount)
+    {
+        qDeleteAll(m_boundaries);
+        m_boundaries.clear();
+    }
+
+    int firstChanged = 0;
+    while (firstChanged < rules.length() && firstChanged < m_rules.length() && rules.at(firstChanged) == m_rules.at(firstChanged)) firstChanged++;
+
+    // boundaries after the first changed rule are out of date, and the latest one before it is where we start
+    for (int rule : m_boundaries.keys())
+    {
+        if (rule > firstChanged) Drop(m_boundaries, rule);
+    }
+    int start = m_boundaries.isEmpty() ? 0 : m_boundaries.lastKey();
+
+    m_rules = rules;
+    m_state = state;
+    m_wordCount = wordCount;
+
+    // the rest of the rules are split into even steps, with the last boundary after all of them
+    int remaining = rules.length() - start;
+    int steps = qMin(remaining, maxBoundaries);
+    for (int step = 1; step <= steps; step++)
+    {
+        Boundary *boundary = new Boundary;
+        boundary->words.resize(wordCount);
+        boundary->data = boundary->words.data();
+        m_recording.insert(start + remaining * step / steps, boundary);
+    }
+
+    qint64 used = 0;
+    for (Boundary *boundary : m_boundaries) used += boundary->size.loadAcquire();
+    m_share = m_recording.isEmpty() ? 0 : (m_budget - used) / m_recording.size();
+    return start;
+}
+
+void Checkpoints::End(bool completed)
+{
+    for (int rule : m_recording.keys())
+    {
+        Boundary *boundary = m_recording.take(rule);
+        if (completed && !boundary->dropped.loadAcquire())
+        {
+            Drop(m_boundaries, rule);
+            m_boundaries.insert(rule, boundary);
+        }
+        else delete boundary;
+    }
+    m_inUse.unlock();
+}
+
+const Checkpoints::WordState &Checkpoints::State(int rule, int word) const
+{
+    static const WordState none;
+    Boundary *boundary = m_boundaries.value(rule);
+    if (!boundary) return none;
+    return boundary->words.at(word);
+}
+
+void Checkpoints::Record(int rule, int word, const WordState &state)
+{
+    Boundary *boundary = m_recording.value(rule);
+    if (!boundary || boundary->dropped.loadAcquire()) return;
+
+    // a rough count of the memory used, which is enough to keep to the budget
+    qint64 size = sizeof(WordState);
+    for (const Subword &subword : state.subwords)
+    {
+        size += sizeof(Subword);
+        for (const QString &form : subword.forms) size += sizeof(QString) + form.length() * sizeof(QChar);
+        for (const Trace::Change &change : subword.changes) size += sizeof(Trace::Change) + (change.rule.length() + change.before.length() + change.after.length()) * sizeof(QChar);
+    }
+
+    if (boundary->size.fetchAndAddRelaxed(size) + size > m_share)
+    {
+        // the words already recorded are freed when the run ends, as other threads may still be writing to it
+        boundary->dropped.storeRelease(1);
+        return;
+    }
+    boundary->data[word] = state;
+}
+
+void Checkpoints::Drop(QMap<int, Boundary *> &boundaries, int rule)
+{
+    delete boundaries.take(rule);
+}
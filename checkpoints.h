@@ -0,0 +1,76 @@
+#ifndef CHECKPOINTS_H
+#define CHECKPOINTS_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QByteArray>
+#include <QMap>
+#include <QMutex>
+#include <QAtomicInteger>
+#include <QAtomicInt>
+#include "trace.h"
+
+// The state of every word at some of the rule boundaries of a previous run. When the rules are edited, a new run can
+// start from the last boundary before the first changed rule instead of applying every rule again. The states are
+// kept within a memory budget; any boundary which doesn't fit is dropped.
+class Checkpoints
+{
+public:
+    struct Subword
+    {
+        QStringList forms;
+        QVector<Trace::Change> changes;     // the changes made to the subword before this boundary
+        bool truncated;
+    };
+
+    struct WordState
+    {
+        QVector<Subword> subwords;
+    };
+
+    explicit Checkpoints(qint64 budget = qint64(512) * 1024 * 1024);
+    ~Checkpoints();
+
+    // Starts a run with the given rules (in the order they are applied) and everything else which affects the state
+    // of the words, as written out by the engine. Both are compared in full, so a different run never picks up stale
+    // words. Returns the rule to start from, or -1 if the checkpoints are being used by another run.
+    int Begin(const QStringList &rules, const QByteArray &state, int wordCount);
+
+    // Finishes the run. The boundaries it recorded are only kept if it completed.
+    void End(bool completed);
+
+    // The state of word at boundary rule, which must be the value returned by Begin()
+    const WordState &State(int rule, int word) const;
+
+    bool ShouldRecord(int rule) const { return m_recording.contains(rule); }
+
+    // Records the state of word after the rules before rule. Different words can be recorded at once from different threads.
+    void Record(int rule, int word, const WordState &state);
+
+private:
+    struct Boundary
+    {
+        QVector<WordState> words;
+        WordState *data = nullptr;          // so threads can write to different words without detaching words
+        QAtomicInteger<qint64> size;        // roughly how much memory words uses, in bytes
+        QAtomicInt dropped;
+    };
+
+    static const int maxBoundaries = 8;
+
+    qint64 m_budget;
+    QMutex m_inUse;                         // held for the whole of a run
+    QStringList m_rules;
+    QByteArray m_state;
+    int m_wordCount = 0;
+    QMap<int, Boundary *> m_boundaries;     // keyed on the number of rules applied
+    QMap<int, Boundary *> m_recording;      // the boundaries being recorded by the current run
+    qint64 m_share = 0;                     // how much memory each of them can use
+
+    void Drop(QMap<int, Boundary *> &boundaries, int rule);
+
+    Q_DISABLE_COPY(Checkpoints)
+};
+
+#endif // CHECKPOINTS_H
@@ -0,0 +1,197 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QCommandLineOption>
+#include <QFile>
+#include <QTextStream>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <random>
+#include <cstdio>
+
+#include "engine.h"
+#include "soundchanges.h"
+#include "lexiconfile.h"
+#include "phonemeinventory.h"
+
+// Reads every line of fileName, or returns false if it can't be opened
+static bool ReadLines(const QString &fileName, QStringList &lines)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) return false;
+
+    QTextStream in(&file);
+    in.setCodec("UTF-8");
+    while (!in.atEnd()) lines.append(in.readLine());
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("exsca-cli");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Applies the sound changes in an .esc file to a lexicon, writing the results to standard output.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("esc", "The .esc file with the categories, rewrites and sound changes.");
+    parser.addPositionalArgument("lex", "The .lex file to read words from. If it is missing or '-', words are read from standard input.", "[lex]");
+
+    QCommandLineOption reverseOption(QStringList() << "r" << "reverse", "Reverse the changes.");
+    QCommandLineOption rewriteOnOutputOption(QStringList() << "w" << "rewrite-on-output", "Apply the rewrite rules backwards to the output.");
+    QCommandLineOption syllabifyOption(QStringList() << "x" << "syllabify", "The regexp used to find syllables for rules with the 'x' flag.", "regexp");
+    QCommandLineOption seperatorOption("seperator", "The syllable seperator.", "char", "-");
+    QCommandLineOption filtersOption(QStringList() << "f" << "filters", "A file of filters, one per line. Words matching any of them are removed.", "file");
+    QCommandLineOption seedOption(QStringList() << "s" << "seed", "The random seed for '?' rules. A new seed is chosen if it is not given.", "number");
+    QCommandLineOption branchLimitOption(QStringList() << "b" << "branch-limit", "The most forms to keep for a word, or 0 for no limit.", "number", "10000");
+    QCommandLineOption formatOption("format", "The output format: plain, arrow, square-input, square-gloss or arrow-gloss.", "format", "plain");
+    QCommandLineOption ruleCacheOption("rule-cache-size", "The most characters of rule results each thread keeps to reuse for later words, or 0 to keep none.", "number", QString::number(1 << 22));
+    QCommandLineOption chunkSizeOption("chunk-size", "The number of words to read from standard input before processing them.", "number", "4096");
+    parser.addOption(reverseOption);
+    parser.addOption(rewriteOnOutputOption);
+    parser.addOption(syllabifyOption);
+    parser.addOption(seperatorOption);
+    parser.addOption(filtersOption);
+    parser.addOption(seedOption);
+    parser.addOption(branchLimitOption);
+    parser.addOption(formatOption);
+    parser.addOption(ruleCacheOption);
+    parser.addOption(chunkSizeOption);
+    parser.process(app);
+
+    QTextStream err(stderr);
+    QStringList arguments = parser.positionalArguments();
+    if (arguments.isEmpty() || arguments.length() > 2) parser.showHelp(1);
+
+    // the .esc file is read the same way as the window reads it
+    QFile escFile(arguments.at(0));
+    if (!escFile.open(QIODevice::ReadOnly))
+    {
+        err << "Could not open " << arguments.at(0) << endl;
+        return 1;
+    }
+    QTextStream esc(&escFile);
+    esc.setCodec("UTF-8");
+    QStringList cats, rews, rules;
+    Engine::SplitEsc(esc, cats, rews, rules);
+    escFile.close();
+
+    Engine::Settings settings;
+    settings.rules = rules.join('\n');
+    settings.rewrites = rews;
+    QString categories = SoundChanges::ApplyRewrite(cats.join('\n'), rews);
+    settings.syllabify = parser.value(syllabifyOption);
+    settings.reverse = parser.isSet(reverseOption);
+    settings.rewriteOnOutput = parser.isSet(rewriteOnOutputOption);
+    settings.branchLimit = parser.value(branchLimitOption).toInt();
+    settings.ruleCacheSize = parser.value(ruleCacheOption).toInt();
+
+    QString seperator = parser.value(seperatorOption);
+    if (!seperator.isEmpty()) settings.syllableSeperator = seperator.at(0);
+
+    if (parser.isSet(filtersOption))
+    {
+        QStringList filters;
+        if (!ReadLines(parser.value(filtersOption), filters))
+        {
+            err << "Could not open " << parser.value(filtersOption) << endl;
+            return 1;
+        }
+        for (const QString &filter : filters)
+        {
+            if (!filter.isEmpty()) settings.filters.append(filter);
+        }
+    }
+
+    bool seedOk;
+    settings.seed = parser.value(seedOption).toULongLong(&seedOk);
+    if (!seedOk)
+    {
+        std::random_device rd;
+        settings.seed = (quint64(rd()) << 32) | rd();
+    }
+
+    QString formatName = parser.value(formatOption);
+    Engine::Format format;
+    if      (formatName == "plain")        format = Engine::Format::Plain;
+    else if (formatName == "arrow")        format = Engine::Format::Arrow;
+    else if (formatName == "square-input") format = Engine::Format::SquareInput;
+    else if (formatName == "square-gloss") format = Engine::Format::SquareGloss;
+    else if (formatName == "arrow-gloss")  format = Engine::Format::ArrowGloss;
+    else
+    {
+        err << "Unknown format " << formatName << endl;
+        return 1;
+    }
+
+    int chunkSize = qMax(1, parser.value(chunkSizeOption).toInt());
+
+    QString lexName = arguments.length() < 2 ? QString("-") : arguments.at(1);
+
+    // files are memory-mapped, so words are only decoded as they are processed
+    LexiconFile lexicon;
+    if (lexName != "-" && !lexicon.Open(lexName))
+    {
+        err << "Could not open " << lexName << endl;
+        return 1;
+    }
+
+    // the IDs given to phonemes can't be characters which are already used; standard input can't be looked at in
+    // advance, but the first IDs are noncharacters, which words shouldn't contain anyway
+    QString rewrittenRules = SoundChanges::ApplyRewrite(settings.rules, rews);
+    settings.phonemes = PhonemeInventory::Find(categories, rewrittenRules);
+    QStringList texts{categories, rewrittenRules, settings.rules, rews.join('\n'), settings.filters.join('\n'), settings.syllabify, lexicon.HighCharacters()};
+    PhonemeInventory phonemes(settings.phonemes, PhonemeInventory::ChooseIds(settings.phonemes.length(), texts));
+    settings.phonemeIds = phonemes.Ids();
+    settings.categories = Engine::ParseCategories(phonemes.Tokenize(categories).split('\n', QString::SkipEmptyParts));
+
+    QFile outFile;
+    outFile.open(stdout, QIODevice::WriteOnly);
+    QTextStream out(&outFile);
+    out.setCodec("UTF-8");
+
+    Engine engine(settings);
+
+    // Results are written out as soon as they are finished, so memory use doesn't depend on the size of the lexicon
+    int truncated = 0;
+    Engine::OutputFunction write = [&](int, QVector<Engine::Result> results)
+    {
+        for (const Engine::Result &result : results)
+        {
+            out << Engine::FormatResult(result, format, false) << '\n';
+            truncated += result.truncated.length();
+        }
+        out.flush();
+    };
+
+    if (lexName != "-")
+    {
+        engine.Run(lexicon, write);
+    }
+    else
+    {
+        // standard input is read and processed a chunk at a time; the engine keeps its caches from one chunk to the next
+        QFile inFile;
+        inFile.open(stdin, QIODevice::ReadOnly);
+        QTextStream in(&inFile);
+        in.setCodec("UTF-8");
+
+        int lineNumber = 0;
+        QStringList chunk;
+        QString line;
+        bool more = true;           // readLineInto() is used instead of atEnd(), which can be wrong for pipes
+        while (more)
+        {
+            chunk.clear();
+            while (chunk.length() < chunkSize && (more = in.readLineInto(&line))) chunk.append(line);
+            if (chunk.isEmpty()) break;
+
+            engine.Run(chunk, write, nullptr, nullptr, lineNumber);
+            lineNumber += chunk.length();
+        }
+    }
+
+    if (truncated > 0) err << truncated << " word(s) had more than " << settings.branchLimit << " possible forms, so only the first "
+                           << settings.branchLimit << " were kept" << endl;
+    return 0;
+}
@@ -0,0 +1,449 @@
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QAtomicInt>
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QScopedArrayPointer>
+#include <QTextStream>
+#include <QMap>
+#include <QHash>
+#include <QList>
+#include <QChar>
+#include <QPair>
+#include <QCache>
+#include <QRegularExpression>
+#include <QByteArray>
+#include <QDataStream>
+#include "engine.h"
+#include "soundchanges.h"
+#include "categorytable.h"
+#include "lexiconfile.h"
+#include "checkpoints.h"
+#include "orderedset.h"
+
+Engine::Engine(const Settings &settings) :
+    m_settings(settings),
+    m_phonemes(settings.phonemes, settings.phonemeIds),
+    m_rewrite(settings.rewrites),
+    m_rewriteBackwards(settings.rewrites, true),
+    m_random(settings.seed)
+{
+    // everything compared with the words is written in the same phonemes as them
+    QString rules = m_phonemes.Tokenize(ApplyRewrite(settings.rules));
+    m_categories = CategoryTable(settings.categories, rules);
+    QStringList filters;
+    for (const QString &filter : settings.filters) filters.append(m_phonemes.Tokenize(filter));
+    m_filters = SoundChanges::CompileFilters(filters, m_categories);
+    m_changes = SoundChanges::CompileRules(rules.split('\n', QString::SkipEmptyParts), m_categories);
+    if (settings.reverse) std::reverse(m_changes.begin(), m_changes.end());
+    m_syllabify = SoundChanges::CompiledRegexp(m_phonemes.Tokenize(settings.syllabify), m_categories);
+    for (const SoundChanges::Rule &change : m_changes)
+    {
+        if (!(change.forwardOnly && settings.reverse) && !(change.backwardOnly && !settings.reverse)) m_removeSeperators = true;
+    }
+}
+
+QString Engine::ApplyRewrite(QString str, bool backwards) const
+{
+    return backwards ? m_rewriteBackwards.Apply(str) : m_rewrite.Apply(str);
+}
+
+Engine::Result Engine::ProcessWord(QString word, int wordNumber, int index, int startRule, SoundChanges::Scratch &scratch) const
+{
+    Result result;
+    scratch.branchLimit = m_settings.branchLimit;
+    if (scratch.ruleResults.maxCost() != m_settings.ruleCacheSize) scratch.ruleResults.setMaxCost(qMax(0, m_settings.ruleCacheSize));
+    bool memoising = m_settings.ruleCacheSize > 0;
+
+    if (word.split('>').length() > 1)
+    {
+        result.hasGloss = true;
+        QStringList split = word.split('>');
+        result.gloss = split.at(1).trimmed();
+        word = split.at(0);
+    }
+    result.word = word.trimmed();
+
+    QStringList subwords = word.split(' ', QString::SkipEmptyParts);
+
+    // if the word was recorded at the checkpoint, we carry on from there instead of applying the earlier rules again
+    bool checkpointing = m_checkpoints && index >= 0;
+    const Checkpoints::WordState *start = nullptr;
+    if (checkpointing && startRule > 0)
+    {
+        start = &m_checkpoints->State(startRule, index);
+        if (start->subwords.length() != subwords.length()) start = nullptr;
+    }
+    if (!start) startRule = 0;
+    QMap<int, Checkpoints::WordState> states;       // the word at each checkpoint this run is recording
+
+    for (int subwordNumber = 0; subwordNumber < subwords.length(); subwordNumber++)
+    {
+        const QString &subword = subwords.at(subwordNumber);
+        int changesStart = result.changes.length();
+        QStringList subchanged;
+        bool truncated = false;
+        if (start)
+        {
+            const Checkpoints::Subword &from = start->subwords.at(subwordNumber);
+            subchanged = from.forms;
+            result.changes.append(from.changes);
+            truncated = from.truncated;
+        }
+        else
+        {
+            // Forms are only gathered into a set when a rule changes them, so any duplicates are removed here. The
+            // seperator is taken out here too, rather than by every rule which doesn't change the form.
+            QString tokens = m_phonemes.Tokenize(ApplyRewrite(subword));
+            if (m_removeSeperators) tokens.remove(m_settings.syllableSeperator);
+            OrderedSet<QString> &forms = scratch.forms;
+            forms.Clear();
+            if (!SoundChanges::AddForms(forms, tokens, m_settings.branchLimit)) truncated = true;
+            subchanged = forms.Values();
+        }
+        SoundChanges::RandomStream subwordRandom = m_random.Substream(wordNumber).Substream(subwordNumber);
+
+        // The characters in each form, and in all of them together, are kept up to date as the forms change. A rule
+        // whose environment can't start with any of them is passed over without looking at the forms at all, so
+        // each word only visits the rules it is a candidate for.
+        QVector<quint64> &masks = scratch.masks;
+        quint64 wordMask = 0;
+        auto updateMasks = [&]()
+        {
+            masks.resize(subchanged.length());
+            wordMask = 0;
+            for (int i = 0; i < subchanged.length(); i++)
+            {
+                masks[i] = Matcher::SymbolMask(subchanged.at(i));
+                wordMask |= masks.at(i);
+            }
+        };
+        updateMasks();
+
+        for (int changeNumber = startRule; changeNumber < m_changes.length(); changeNumber++)
+        {
+            const SoundChanges::Rule &change = m_changes.at(changeNumber);
+            bool skipThisRule = (change.forwardOnly && m_settings.reverse) || (change.backwardOnly && !m_settings.reverse);
+            bool reverseThisRule = m_settings.reverse && !change.backwardOnly;      // So we can use normal rules with no special handling
+
+            // The forms from every candidate are gathered into one set, so duplicates are removed as they are added.
+            // Most rules leave every form alone, so the set is only built once one of them has changed; until then
+            // nothing is allocated.
+            OrderedSet<QString> &forms = scratch.forms;
+            bool changed = false;
+            auto startChanging = [&](int i)
+            {
+                if (changed) return;
+                changed = true;
+                forms.Clear();
+                for (int j = 0; j < i; j++) forms.Insert(subchanged.at(j));     // there are fewer of these than the limit
+            };
+            bool candidate = !skipThisRule && (reverseThisRule || (wordMask & change.matcher.FirstMask()));
+            if (candidate)
+            {
+                // random rules give different results each time, so they can't be kept
+                bool memoise = memoising && change.probability >= 100;
+                for (int i = 0; i < subchanged.length(); i++)
+                {
+                    const QString &_subchanged = subchanged.at(i);
+
+                    // most rules can't match most forms, which can be seen from their characters alone; those are passed
+                    // over before the cache, so it only holds results which are worth keeping
+                    if (!reverseThisRule && !(masks.at(i) & change.matcher.FirstMask()))
+                    {
+                        if (changed && !SoundChanges::AddForms(forms, _subchanged, m_settings.branchLimit)) truncated = true;
+                        continue;
+                    }
+
+                    QPair<int, QString> key(changeNumber, _subchanged);
+                    const SoundChanges::RuleResult *applied = memoise ? scratch.ruleResults.object(key) : nullptr;
+                    SoundChanges::RuleResult &fresh = scratch.ruleResult;
+                    if (!applied)
+                    {
+                        SoundChanges::RandomStream changeRandom = subwordRandom.Substream(changeNumber).Substream(i);
+                        fresh.before = change.syllabify ? SoundChanges::Syllabify(m_syllabify, _subchanged, m_settings.syllableSeperator) : _subchanged;
+                        scratch.truncated = false;
+                        bool same = !SoundChanges::ApplyChange(fresh.before, change, m_categories, reverseThisRule, scratch, changeRandom);
+
+                        if (same)
+                        {
+                            if (scratch.truncated) truncated = true;
+                            if (changed && !SoundChanges::AddForms(forms, _subchanged, m_settings.branchLimit)) truncated = true;
+                            continue;
+                        }
+
+                        OrderedSet<QString> after;
+                        for (QString form : scratch.results) after.Insert(form.remove(m_settings.syllableSeperator));
+                        fresh.after = after.Values();
+                        fresh.truncated = scratch.truncated;
+                        applied = &fresh;
+                        if (memoise && (fresh.after.length() != 1 || fresh.after.first() != _subchanged))
+                        {
+                            int cost = _subchanged.length() + fresh.before.length() + 1;
+                            for (const QString &form : fresh.after) cost += form.length() + 1;
+                            scratch.ruleResults.insert(key, new SoundChanges::RuleResult(fresh), cost);
+                        }
+                    }
+
+                    if (applied->truncated) truncated = true;
+                    if (applied->after.length() == 1 && applied->after.first() == _subchanged)
+                    {
+                        if (changed && !SoundChanges::AddForms(forms, _subchanged, m_settings.branchLimit)) truncated = true;
+                        continue;
+                    }
+                    startChanging(i);
+                    // the limit is kept for the word as a whole, not just for each form the rule is applied to
+                    for (const QString &form : applied->after)
+                    {
+                        if (!SoundChanges::AddForms(forms, form, m_settings.branchLimit)) truncated = true;
+                    }
+
+                    if (m_settings.reportChanges)
+                    {
+                        QString after = applied->after.join(' ');
+                        if (after != applied->before) result.changes.append(Trace::Change{m_phonemes.Text(change.change), m_phonemes.Text(applied->before), m_phonemes.Text(after)});
+                    }
+                }
+            }
+            if (changed)
+            {
+                subchanged = forms.Values();
+                updateMasks();
+            }
+
+            if (checkpointing && m_checkpoints->ShouldRecord(changeNumber + 1))
+                states[changeNumber + 1].subwords.append(Checkpoints::Subword{subchanged, result.changes.mid(changesStart), truncated});
+        }
+        if (truncated && !result.truncated.contains(subword)) result.truncated.append(subword);
+
+        QString subchangedJoined = m_phonemes.Text(SoundChanges::Filter(subchanged, m_filters).join(' '));
+        if (m_settings.rewriteOnOutput) subchangedJoined = ApplyRewrite(subchangedJoined, true);
+        result.subwords.append(std::make_pair(subword, subchangedJoined));
+    }
+
+    for (auto it = states.constBegin(); it != states.constEnd(); ++it) m_checkpoints->Record(it.key(), index, it.value());
+    return result;
+}
+
+namespace
+{
+    // The most results which can be finished but not yet passed to output, so memory use doesn't depend on the
+    // size of the lexicon
+    const int resultWindow = 1 << 16;
+
+    // Each worker takes the next unprocessed word whenever it finishes one, so a few words with lots of forms
+    // don't hold up all the others on the same thread
+    class Worker : public QRunnable
+    {
+    public:
+        Worker(const Engine &engine, int count, const Engine::LineFunction &line, Engine::Result *results, QAtomicInt *finished, QAtomicInt &next, QAtomicInt &written, QAtomicInt &done, const QAtomicInt *cancelled, int firstNumber, int startRule, SoundChanges::ScratchPool &scratches) :
+            m_engine(engine), m_count(count), m_line(line), m_results(results), m_finished(finished), m_next(next), m_written(written), m_done(done), m_cancelled(cancelled), m_firstNumber(firstNumber), m_startRule(startRule), m_scratches(scratches)
+        {
+        }
+
+        void run() override
+        {
+            SoundChanges::Scratch *scratch = m_scratches.Take();
+            Process(*scratch);
+            m_scratches.Return(scratch);
+        }
+
+    private:
+        void Process(SoundChanges::Scratch &scratch)
+        {
+            for (int i = m_next.fetchAndAddRelaxed(1); i < m_count; i = m_next.fetchAndAddRelaxed(1))
+            {
+                // wait until the slot for this word has been passed to output
+                while (i - m_written.loadAcquire() >= resultWindow)
+                {
+                    if (m_cancelled && m_cancelled->loadAcquire()) return;
+                    QThread::msleep(1);
+                }
+                if (m_cancelled && m_cancelled->loadAcquire()) return;
+
+                // words are only recorded at checkpoints if the run is using them
+                m_results[i % resultWindow] = m_engine.ProcessWord(m_line(i), m_firstNumber + i, m_startRule >= 0 ? i : -1, qMax(0, m_startRule), scratch);
+                m_finished[i % resultWindow].storeRelease(i + 1);      // the slots are reused, so we record which word is in it
+                m_done.fetchAndAddRelease(1);
+            }
+        }
+
+        const Engine &m_engine;
+        int m_count;
+        const Engine::LineFunction &m_line;
+        Engine::Result *m_results;
+        QAtomicInt *m_finished;
+        QAtomicInt &m_next;
+        QAtomicInt &m_written;
+        QAtomicInt &m_done;
+        const QAtomicInt *m_cancelled;
+        int m_firstNumber;
+        int m_startRule;        // the checkpoint the run starts from, or -1 if it isn't using checkpoints
+        SoundChanges::ScratchPool &m_scratches;
+    };
+}
+
+bool Engine::Run(const QStringList &words, OutputFunction output, ProgressFunction progress, const QAtomicInt *cancelled, int firstNumber) const
+{
+    return Run(words.length(), [&words](int i) { return words.at(i); }, output, progress, cancelled, firstNumber);
+}
+
+bool Engine::Run(const LexiconFile &lexicon, OutputFunction output, ProgressFunction progress, const QAtomicInt *cancelled) const
+{
+    return Run(lexicon.Count(), [&lexicon](int i) { return lexicon.Line(i); }, output, progress, cancelled);
+}
+
+bool Engine::Run(int count, LineFunction line, OutputFunction output, ProgressFunction progress, const QAtomicInt *cancelled, int firstNumber) const
+{
+    // every result slot is written by exactly one worker at a time, so they can all write into the same vector
+    // without locking
+    int slots = qMin(count, resultWindow);
+    QVector<Engine::Result> results(slots);
+    QScopedArrayPointer<QAtomicInt> finished(new QAtomicInt[qMax(1, slots)]);
+    QAtomicInt next(0);
+    QAtomicInt written(0);      // the number of results which have been passed to output
+    QAtomicInt done(0);
+
+    // if the rules have only been edited since the last run, the words are taken from the last checkpoint before the
+    // first changed rule
+    int startRule = m_checkpoints ? m_checkpoints->Begin(RuleKeys(), StateKey(firstNumber), count) : -1;
+
+    // passes on the results which are finished and have nothing unfinished before them
+    auto writeFinished = [&]()
+    {
+        int first = written.loadAcquire();
+        int last = first;
+        while (last < count && finished[last % resultWindow].loadAcquire() == last + 1) last++;
+        if (last == first) return;
+
+        QVector<Result> batch;
+        batch.reserve(last - first);
+        for (int i = first; i < last; i++)
+        {
+            batch.append(results.at(i % resultWindow));
+            results[i % resultWindow] = Result();      // so finished results don't stay in memory
+        }
+        written.storeRelease(last);
+        if (output) output(first, batch);
+    };
+
+    QThreadPool pool;
+    int threads = qBound(1, QThread::idealThreadCount(), qMax(1, count));
+    pool.setMaxThreadCount(threads);
+    for (int i = 0; i < threads; i++) pool.start(new Worker(*this, count, line, results.data(), finished.data(), next, written, done, cancelled, firstNumber, startRule, m_scratches));
+
+    // polling also limits how often output and progress are called, however quickly the words are finished
+    while (!pool.waitForDone(50))
+    {
+        writeFinished();
+        if (progress) progress(done.loadAcquire());
+    }
+    writeFinished();
+    if (progress) progress(done.loadAcquire());
+
+    bool completed = written.loadAcquire() == count;
+    if (startRule >= 0) m_checkpoints->End(completed);
+    return completed;
+}
+
+QStringList Engine::RuleKeys() const
+{
+    QStringList keys;
+    keys.reserve(m_changes.length());
+    for (const SoundChanges::Rule &change : m_changes) keys.append(change.key);
+    return keys;
+}
+
+// Everything which changes the words before the filters, other than the rules themselves, written out in full so
+// checkpoints are only used if all of it is exactly the same
+QByteArray Engine::StateKey(int firstNumber) const
+{
+    QByteArray key;
+    QDataStream out(&key, QIODevice::WriteOnly);
+    out << m_settings.lexiconKey << qint32(firstNumber) << m_settings.categories << m_settings.rewrites << m_settings.phonemes
+        << m_settings.phonemeIds << m_settings.syllabify << m_settings.syllableSeperator << m_settings.reverse
+        << m_settings.reportChanges << qint32(m_settings.branchLimit);
+
+    // the seed only matters if some rule is random
+    for (const SoundChanges::Rule &change : m_changes)
+    {
+        if (change.probability < 100)
+        {
+            out << m_settings.seed;
+            break;
+        }
+    }
+    return key;
+}
+
+QString Engine::FormatResult(const Result &result, Format format, bool markChanged)
+{
+    QString out = "";
+    for (const std::pair<QString, QString> &subword : result.subwords)
+    {
+        QString subchangedJoined = subword.second;
+        if (markChanged && subchangedJoined != subword.first) subchangedJoined = QString("<b>").append(subchangedJoined).append("</b>");
+
+        if (out.length() == 0) out =        subchangedJoined;
+        else                   out += ' ' + subchangedJoined;
+    }
+    out = out.trimmed();
+
+    const QString &in = result.word;
+    const QString &gloss = result.gloss;
+    const QChar arrow(0x2192);
+    switch (format)
+    {
+    case Format::Plain:
+        if (result.hasGloss) return QString("%1 > %2").arg(out, gloss);
+        else                 return out;
+    case Format::Arrow:
+        return QString("%1 %2 %3").arg(in, arrow, out);
+    case Format::SquareInput:
+        return QString("%1 [%2]").arg(out, in);
+    case Format::SquareGloss:
+        if (result.hasGloss) return QString("%1 [%2]").arg(out, gloss);
+        else                 return out;
+    case Format::ArrowGloss:
+        if (result.hasGloss) return QString("%1 %2 %3 [%4]").arg(in, arrow, out, gloss);
+        else                 return QString("%1 %2 %3").arg(in, arrow, out);
+    }
+    return out;
+}
+
+QMap<QChar, QList<QChar>> Engine::ParseCategories(const QStringList &lines)
+{
+    static const QRegularExpression categoryLine("^.=.+$");
+
+    QMap<QChar, QList<QChar>> categories;
+    for (const QString &line : lines)
+    {
+        if (!categoryLine.match(line).hasMatch()) continue;
+        QStringList parts = line.split("=");
+
+        QList<QChar> phonemes;
+        for (QChar c : parts.at(1))
+        {
+            if (categories.contains(c)) phonemes.append(categories.value(c));
+            else phonemes.append(c);
+        }
+        categories.insert(parts.at(0).at(0), phonemes);
+    }
+    return categories;
+}
+
+void Engine::SplitEsc(QTextStream &in, QStringList &categories, QStringList &rewrites, QStringList &rules)
+{
+    while (!in.atEnd())
+    {
+        QString line = in.readLine();
+        if (line.contains('=')) categories.append(line);
+        else if (line.contains('>') && !line.contains('/')) rewrites.append(line);
+        else rules.append(line);
+    }
+}
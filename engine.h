@@ -0,0 +1,129 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <QString>
+#include <QStringList>
+#include <QList>
+#include <QMap>
+#include <QVector>
+#include <QByteArray>
+#include <QRegularExpression>
+#include <QMetaType>
+#include <functional>
+#include <utility>
+#include "soundchanges.h"
+#include "categorytable.h"
+#include "trace.h"
+#include "phonemeinventory.h"
+#include "rewriter.h"
+
+// Applies the sound changes to a lexicon. Everything it needs is copied in when it is constructed, so it doesn't
+// depend on the window and the words can be processed on any number of threads at once.
+class QAtomicInt;
+class QTextStream;
+class LexiconFile;
+class Checkpoints;
+
+class Engine
+{
+public:
+    struct Settings
+    {
+        QString rules;                          // the sound changes, one per line, before rewriting
+        QStringList rewrites;                   // lines of the form 'from>to'
+        QMap<QChar, QList<QChar>> categories;   // parsed after tokenizing with phonemes
+        QStringList phonemes;                   // from PhonemeInventory::Find()
+        QString phonemeIds;                     // from PhonemeInventory::ChooseIds(), or empty for the default IDs
+        QStringList filters;
+        QString syllabify;                      // the regexp used to split words into syllables for the 'x' flag
+        QChar syllableSeperator = '-';
+        bool reverse = false;
+        bool rewriteOnOutput = false;
+        bool reportChanges = false;
+        quint64 seed = 0;
+        int branchLimit = 0;
+        int ruleCacheSize = 1 << 22;            // the most characters each thread keeps of the results of non-random rules
+        QByteArray lexiconKey;                  // identifies the lexicon, so checkpoints from another one aren't used
+    };
+
+    // The result of applying the sound changes to one line of the lexicon
+    struct Result
+    {
+        QString word;                           // the line without its gloss
+        QString gloss;
+        bool hasGloss = false;
+        QVector<std::pair<QString, QString>> subwords;  // each subword, and the space-seperated forms it changed to
+        QVector<Trace::Change> changes;         // which rules changed the word, if Settings::reportChanges is set
+        QStringList truncated;                  // the subwords which had too many forms to keep them all
+    };
+
+    enum class Format
+    {
+        Plain,                  // output > gloss
+        Arrow,                  // input → output
+        SquareInput,            // output [input]
+        SquareGloss,            // output [gloss]
+        ArrowGloss              // input → output [gloss]
+    };
+
+    explicit Engine(const Settings &settings);
+
+    const Settings &GetSettings() const { return m_settings; }
+    const CategoryTable &Categories() const { return m_categories; }
+    const PhonemeInventory &Phonemes() const { return m_phonemes; }
+
+    // If checkpoints are set, later runs with the same settings and lexicon only apply the rules from the first one
+    // which has changed. Only one engine can use them at a time; a run which finds them in use applies every rule.
+    void SetCheckpoints(Checkpoints *checkpoints) { m_checkpoints = checkpoints; }
+
+    // Applies the rules to word, which is line index of a run starting from the checkpoint after the rules before
+    // startRule. If index is -1, checkpoints aren't used.
+    Result ProcessWord(QString word, int wordNumber, int index, int startRule, SoundChanges::Scratch &scratch) const;
+
+    typedef std::function<void(int)> ProgressFunction;                  // the number of lines finished so far
+    typedef std::function<void(int, QVector<Result>)> OutputFunction;   // the line number of the first result, and the results
+    typedef std::function<QString(int)> LineFunction;                   // returns a line of the lexicon; it is called from every worker thread
+
+    // Processes every line of words using all the cores. output is called with each batch of results as soon as all
+    // the lines before them have finished, so the results come out in the same order as words and are identical to
+    // processing the lines one by one. output and progress are both called on the calling thread. Returns false if
+    // it was stopped early by setting cancelled. If words is part of a bigger lexicon, firstNumber is the line number
+    // of its first line, so random numbers are drawn the same as if the whole lexicon was processed at once.
+    bool Run(const QStringList &words, OutputFunction output, ProgressFunction progress = nullptr, const QAtomicInt *cancelled = nullptr, int firstNumber = 0) const;
+    bool Run(int count, LineFunction line, OutputFunction output, ProgressFunction progress = nullptr, const QAtomicInt *cancelled = nullptr, int firstNumber = 0) const;
+
+    // Lines are decoded straight from the mapped file as they are processed, so the lexicon isn't copied
+    bool Run(const LexiconFile &lexicon, OutputFunction output, ProgressFunction progress = nullptr, const QAtomicInt *cancelled = nullptr) const;
+
+    // Formats one line of output. If markChanged is set, subwords which have changed are made bold using HTML.
+    static QString FormatResult(const Result &result, Format format, bool markChanged);
+
+    // Parses lines of the form 'C=ptk' into categories. Categories used in the members of later ones are expanded.
+    // Multigraphs have to be tokenized first.
+    static QMap<QChar, QList<QChar>> ParseCategories(const QStringList &lines);
+
+    // Sorts the lines of an .esc file into categories, rewrites and sound changes
+    static void SplitEsc(QTextStream &in, QStringList &categories, QStringList &rewrites, QStringList &rules);
+
+private:
+    Settings m_settings;
+    PhonemeInventory m_phonemes;
+    Rewriter m_rewrite;
+    Rewriter m_rewriteBackwards;
+    SoundChanges::FilterSet m_filters;
+    CategoryTable m_categories;
+    QList<SoundChanges::Rule> m_changes;
+    QRegularExpression m_syllabify;
+    bool m_removeSeperators = false;        // set if any rule is applied, as each one takes the seperator out of every form
+    SoundChanges::RandomStream m_random;
+    Checkpoints *m_checkpoints = nullptr;
+    mutable SoundChanges::ScratchPool m_scratches;  // kept between runs, so running a lexicon in parts doesn't lose the caches
+
+    QString ApplyRewrite(QString str, bool backwards = false) const;
+    QStringList RuleKeys() const;
+    QByteArray StateKey(int firstNumber) const;
+};
+
+Q_DECLARE_METATYPE(Engine::Result)
+
+#endif // ENGINE_H
@@ -0,0 +1,24 @@
+# The sound change engine, which doesn't depend on QtWidgets and is shared by the GUI and the command line tool
+
+SOURCES += \
+    $$PWD/soundchanges.cpp \
+    $$PWD/categorytable.cpp \
+    $$PWD/matcher.cpp \
+    $$PWD/engine.cpp \
+    $$PWD/lexiconfile.cpp \
+    $$PWD/trace.cpp \
+    $$PWD/checkpoints.cpp \
+    $$PWD/phonemeinventory.cpp \
+    $$PWD/rewriter.cpp
+
+HEADERS += \
+    $$PWD/soundchanges.h \
+    $$PWD/categorytable.h \
+    $$PWD/matcher.h \
+    $$PWD/engine.h \
+    $$PWD/lexiconfile.h \
+    $$PWD/trace.h \
+    $$PWD/checkpoints.h \
+    $$PWD/phonemeinventory.h \
+    $$PWD/rewriter.h \
+    $$PWD/orderedset.h
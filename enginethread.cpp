@@ -0,0 +1,46 @@
+#include <QThread>
+#include <QStringList>
+#include <QVector>
+#include <QAtomicInt>
+#include <QMetaType>
+#include <QSharedPointer>
+#include "enginethread.h"
+#include "engine.h"
+#include "lexiconfile.h"
+#include "checkpoints.h"
+
+EngineThread::EngineThread(const Engine::Settings &settings, const QStringList &words, QObject *parent) :
+    QThread(parent),
+    m_settings(settings),
+    m_words(words),
+    m_cancelled(0)
+{
+    qRegisterMetaType<QVector<Engine::Result>>();
+}
+
+EngineThread::EngineThread(const Engine::Settings &settings, QSharedPointer<LexiconFile> lexicon, QObject *parent) :
+    QThread(parent),
+    m_settings(settings),
+    m_lexicon(lexicon),
+    m_cancelled(0)
+{
+    qRegisterMetaType<QVector<Engine::Result>>();
+}
+
+void EngineThread::Cancel()
+{
+    m_cancelled.storeRelease(1);
+}
+
+void EngineThread::run()
+{
+    // the rules are compiled here too, as that can take a while for a big set of changes
+    Engine engine(m_settings);
+    engine.SetCheckpoints(m_checkpoints.data());
+    Engine::OutputFunction sendOutput = [this](int first, QVector<Engine::Result> results) { emit output(first, results); };
+    Engine::ProgressFunction sendProgress = [this](int done) { emit progress(done); };
+    bool completed;
+    if (m_lexicon) completed = engine.Run(*m_lexicon, sendOutput, sendProgress, &m_cancelled);
+    else           completed = engine.Run(m_words, sendOutput, sendProgress, &m_cancelled);
+    emit finishedRun(!completed);
+}
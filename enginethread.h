@@ -0,0 +1,45 @@
+#ifndef ENGINETHREAD_H
+#define ENGINETHREAD_H
+
+#include <QThread>
+#include <QStringList>
+#include <QVector>
+#include <QAtomicInt>
+#include <QSharedPointer>
+#include "engine.h"
+#include "lexiconfile.h"
+#include "checkpoints.h"
+
+// Runs the engine over a lexicon in the background, so the window stays responsive during long runs. Results are
+// sent back in input order as soon as they are ready, and the run can be cancelled at any time.
+class EngineThread : public QThread
+{
+    Q_OBJECT
+
+public:
+    EngineThread(const Engine::Settings &settings, const QStringList &words, QObject *parent = 0);
+    EngineThread(const Engine::Settings &settings, QSharedPointer<LexiconFile> lexicon, QObject *parent = 0);
+
+    // Stops the run after the words currently being processed; finishedRun() is still emitted
+    void Cancel();
+
+    // The run starts from and records checkpoints, unless another run is still using them
+    void SetCheckpoints(QSharedPointer<Checkpoints> checkpoints) { m_checkpoints = checkpoints; }
+
+signals:
+    void progress(int done);
+    void output(int first, QVector<Engine::Result> results);
+    void finishedRun(bool cancelled);
+
+protected:
+    void run() override;
+
+private:
+    Engine::Settings m_settings;
+    QStringList m_words;
+    QSharedPointer<LexiconFile> m_lexicon;     // if this is set, it is used instead of m_words
+    QSharedPointer<Checkpoints> m_checkpoints;
+    QAtomicInt m_cancelled;
+};
+
+#endif // ENGINETHREAD_H
@@ -4,17 +4,29 @@ TARGET = exSCA
 QT = core gui
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
+include(engine.pri)
+
 SOURCES += \
     main.cpp \
     window.cpp \
-    soundchanges.cpp \
     highlighter.cpp \
-    affixerdialog.cpp
+    affixerdialog.cpp \
+    affixgenerator.cpp \
+    affixpreviewthread.cpp \
+    enginethread.cpp \
+    resultstore.cpp \
+    resultmodel.cpp \
+    tracedialog.cpp
 
 HEADERS += \
     window.h \
-    soundchanges.h \
     highlighter.h \
-    affixerdialog.h
+    affixerdialog.h \
+    affixgenerator.h \
+    affixpreviewthread.h \
+    enginethread.h \
+    resultstore.h \
+    resultmodel.h \
+    tracedialog.h
 
 RC_ICONS = Icon.ico
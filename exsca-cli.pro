@@ -0,0 +1,11 @@
+TEMPLATE = app
+TARGET = exsca-cli
+
+QT = core
+CONFIG += console
+CONFIG -= app_bundle
+
+include(engine.pri)
+
+SOURCES += \
+    climain.cpp
@@ -0,0 +1,84 @@
+#include <QFile>
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+#include <cstring>
+#include <climits>
+#include "lexiconfile.h"
+
+LexiconFile::LexiconFile() : m_data(nullptr), m_size(0), m_count(0)
+{
+}
+
+LexiconFile::~LexiconFile()
+{
+    if (m_data) m_file.unmap(reinterpret_cast<uchar *>(const_cast<char *>(m_data)));
+}
+
+bool LexiconFile::Open(const QString &fileName)
+{
+    m_fileName = fileName;
+    m_file.setFileName(fileName);
+    if (!m_file.open(QIODevice::ReadOnly)) return false;
+
+    m_size = m_file.size();
+    m_count = 0;
+    m_blockStarts.clear();
+    m_highCharacters.clear();
+    if (m_size == 0) return true;           // empty files can't be mapped, but they don't have any lines anyway
+
+    m_data = reinterpret_cast<const char *>(m_file.map(0, m_size));
+    if (!m_data) return false;
+
+    // skip the UTF-8 byte order mark if there is one
+    qint64 start = (m_size >= 3 && std::memcmp(m_data, "\xEF\xBB\xBF", 3) == 0) ? 3 : 0;
+    while (start < m_size && m_count < INT_MAX)
+    {
+        if (m_count % blockLines == 0) m_blockStarts.append(start);
+        m_count++;
+        const void *end = std::memchr(m_data + start, '\n', m_size - start);
+        if (!end) break;
+        start = static_cast<const char *>(end) - m_data + 1;
+    }
+    FindHighCharacters();
+    return true;
+}
+
+// Characters from U+E000 to U+FFFF are the only ones encoded as three bytes starting with 0xEE or 0xEF, so those are
+// the only bytes that need to be looked for
+void LexiconFile::FindHighCharacters()
+{
+    QVector<bool> seen(0x2000, false);
+    for (uchar lead : {uchar(0xEE), uchar(0xEF)})
+    {
+        for (qint64 i = 0; i + 2 < m_size; i++)
+        {
+            const void *found = std::memchr(m_data + i, lead, m_size - i);
+            if (!found) break;
+            i = static_cast<const char *>(found) - m_data;
+            if (i + 2 >= m_size) break;
+
+            uchar second = uchar(m_data[i + 1]), third = uchar(m_data[i + 2]);
+            if ((second & 0xC0) != 0x80 || (third & 0xC0) != 0x80) continue;
+            ushort c = ushort(((lead & 0x0F) << 12) | ((second & 0x3F) << 6) | (third & 0x3F));
+            if (!seen.at(c - 0xE000))
+            {
+                seen[c - 0xE000] = true;
+                m_highCharacters.append(QChar(c));
+            }
+        }
+    }
+}
+
+QByteArray LexiconFile::LineView(int i) const
+{
+    // go forward from the start of the block to the line
+    qint64 start = m_blockStarts.at(i / blockLines);
+    for (int skip = i % blockLines; skip > 0; skip--)
+        start = static_cast<const char *>(std::memchr(m_data + start, '\n', m_size - start)) - m_data + 1;
+
+    const void *newline = std::memchr(m_data + start, '\n', m_size - start);
+    qint64 end = newline ? static_cast<const char *>(newline) - m_data : m_size;
+    if (end > start && m_data[end - 1] == '\r') end--;
+    return QByteArray::fromRawData(m_data + start, int(end - start));
+}
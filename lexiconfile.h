@@ -0,0 +1,48 @@
+#ifndef LEXICONFILE_H
+#define LEXICONFILE_H
+
+#include <QFile>
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+
+// A .lex file which is memory-mapped instead of being read in. Only the start of every blockLines'th line is recorded
+// when it is opened, and the lines in between are found when they are asked for; lines are handed out as views into
+// the mapping and are only decoded from UTF-8 when they are used, so the whole lexicon is never held in memory at once.
+class LexiconFile
+{
+public:
+    LexiconFile();
+    ~LexiconFile();
+
+    bool Open(const QString &fileName);
+
+    const QString &FileName() const { return m_fileName; }
+    qint64 Size() const { return m_size; }
+    int Count() const { return m_count; }
+
+    // The characters from U+E000 up which appear in the file, so phoneme IDs can be chosen which don't clash with them
+    const QString &HighCharacters() const { return m_highCharacters; }
+
+    // Returns line i without its line ending. The data isn't copied, so it is only valid while the file is open.
+    QByteArray LineView(int i) const;
+
+    QString Line(int i) const { return QString::fromUtf8(LineView(i)); }
+
+private:
+    Q_DISABLE_COPY(LexiconFile)
+
+    static const int blockLines = 64;
+
+    QString m_fileName;
+    QFile m_file;
+    const char *m_data;
+    qint64 m_size;
+    int m_count;
+    QVector<qint64> m_blockStarts;          // the start of lines 0, blockLines, 2 * blockLines...
+    QString m_highCharacters;
+
+    void FindHighCharacters();
+};
+
+#endif // LEXICONFILE_H
@@ -0,0 +1,443 @@
+#include <QChar>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QVarLengthArray>
+#include <utility>
+#include <algorithm>
+#include <QtAlgorithms>
+#include "matcher.h"
+#include "categorytable.h"
+
+// SSE2 is always there on x64; AVX2 is only used if the compiler has been told it can be
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MATCHER_SSE2
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    // Sets with more characters than this are searched a character at a time, as comparing against every one of
+    // them would be no faster
+    const int maxVectorSymbols = 8;
+
+    // Returns the first position from from onwards whose character is in symbols, which is sorted, or the length of
+    // word if there isn't one. Several characters are compared at once where the processor allows it.
+    int NextCandidate(const QString &word, int from, const QString &symbols)
+    {
+        const ushort *data = word.utf16();
+        int length = word.length();
+        int i = from;
+
+        if (symbols.length() <= maxVectorSymbols)
+        {
+#ifdef __AVX2__
+            __m256i wide[maxVectorSymbols];
+            for (int k = 0; k < symbols.length(); k++) wide[k] = _mm256_set1_epi16(short(symbols.at(k).unicode()));
+            for (; i + 16 <= length; i += 16)
+            {
+                __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+                __m256i hit = _mm256_setzero_si256();
+                for (int k = 0; k < symbols.length(); k++) hit = _mm256_or_si256(hit, _mm256_cmpeq_epi16(chunk, wide[k]));
+                quint32 mask = quint32(_mm256_movemask_epi8(hit));
+                if (mask) return i + int(qCountTrailingZeroBits(mask)) / 2;      // each character gives two bits of the mask
+            }
+#endif
+#ifdef MATCHER_SSE2
+            __m128i narrow[maxVectorSymbols];
+            for (int k = 0; k < symbols.length(); k++) narrow[k] = _mm_set1_epi16(short(symbols.at(k).unicode()));
+            for (; i + 8 <= length; i += 8)
+            {
+                __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+                __m128i hit = _mm_setzero_si128();
+                for (int k = 0; k < symbols.length(); k++) hit = _mm_or_si128(hit, _mm_cmpeq_epi16(chunk, narrow[k]));
+                quint32 mask = quint32(_mm_movemask_epi8(hit));
+                if (mask) return i + int(qCountTrailingZeroBits(mask)) / 2;
+            }
+#endif
+        }
+
+        for (; i < length; i++)
+        {
+            if (std::binary_search(symbols.begin(), symbols.end(), word.at(i))) return i;
+        }
+        return length;
+    }
+}
+
+Matcher::Matcher()
+{
+}
+
+Matcher::Matcher(const QString &environment, const QString &target, const QStringList &exceptions, const CategoryTable &categories)
+{
+    m_program = Compile(environment, target, categories);
+    for (const QString &exception : exceptions)
+    {
+        m_exceptions.append(Compile(exception, target, categories));
+        m_exceptionFirst.append(FirstSymbols(m_exceptions.last(), 0, categories));
+    }
+
+    m_environmentFirst = FirstSymbols(m_program, 0, categories);
+    if (!m_environmentFirst.isEmpty()) m_firstMask = SymbolMask(m_environmentFirst);
+}
+
+quint64 Matcher::SymbolMask(const QString &word)
+{
+    quint64 mask = 0;
+    for (QChar c : word) mask |= quint64(1) << (c.unicode() & 63);
+    return mask;
+}
+
+void Matcher::FindMatches(const QString &word, const CategoryTable &categories, Workspace &workspace, Matches &result) const
+{
+    Run(m_program, m_environmentFirst, word, categories, workspace, result);
+    if (m_exceptions.isEmpty() || result.matches.isEmpty()) return;
+
+    // An exception rules out any match whose target starts in the same place as the target of the exception
+    workspace.blocked.fill(false, word.length() + 1);
+    for (int i = 0; i < m_exceptions.length(); i++)
+    {
+        Run(m_exceptions.at(i), m_exceptionFirst.at(i), word, categories, workspace, workspace.exceptionMatches);
+        for (const Match &match : workspace.exceptionMatches.matches)
+        {
+            workspace.blocked[match.targetStart] = true;
+        }
+    }
+
+    for (int i = 0; i <= word.length(); i++)
+    {
+        int m = result.at.at(i);
+        if (m >= 0 && workspace.blocked.at(result.matches.at(m).targetStart)) result.at[i] = -1;
+    }
+}
+
+Matcher::Program Matcher::Compile(const QString &pattern, const QString &target, const CategoryTable &categories)
+{
+    Program program;
+    int i = 0;
+    bool afterTarget = false;
+    CompileSequence(pattern, i, 0, target, false, afterTarget, categories, program);
+    Emit(program, Op::Match, false);
+    return program;
+}
+
+void Matcher::CompileSequence(const QString &pattern, int &i, int depth, const QString &target, bool inTarget, bool &afterTarget, const CategoryTable &categories, Program &program)
+{
+    while (i < pattern.length())
+    {
+        QChar c = pattern.at(i++);
+        Op boundary = inTarget ? Op::Boundary : (afterTarget ? Op::EndBoundary : Op::StartBoundary);
+
+        if (c == ')')
+        {
+            if (depth > 0) return;
+        }
+        else if (c == '(')
+        {
+            // an optional part is a split between the part itself (preferred) and whatever comes after it
+            int split = program.length();
+            Emit(program, Op::Split, inTarget);
+            CompileSequence(pattern, i, depth + 1, target, inTarget, afterTarget, categories, program);
+            program[split].x = split + 1;
+            program[split].y = program.length();
+        }
+        else if (c == '[')
+        {
+            int end = pattern.indexOf(']', i);
+            if (end < 0)
+            {
+                i = pattern.length();
+                return;
+            }
+            CategoryTable::Nonce nonce = categories.ParseNonce(pattern.midRef(i, end - i));
+            i = end + 1;
+
+            if (!nonce.positive) Emit(program, Op::NotNonce, inTarget, QChar(), 0, 0, nonce.members);
+            else if (nonce.members.contains('#'))
+            {
+                // '#' in a nonce category matches a word boundary instead of a character
+                int split = program.length();
+                Emit(program, Op::Split, inTarget, QChar(), split + 1, split + 3);
+                Emit(program, boundary, inTarget);
+                int jump = program.length();
+                Emit(program, Op::Jump, inTarget);
+                Emit(program, Op::Nonce, inTarget, QChar(), 0, 0, nonce.members);
+                program[jump].x = program.length();
+            }
+            else Emit(program, Op::Nonce, inTarget, QChar(), 0, 0, nonce.members);
+        }
+        else if (c == '@')
+        {
+            if (i >= pattern.length()) return;
+            QChar digit = pattern.at(i++);
+            int backreference = digit.digitValue() - 1;     // We start at '@1' but this corresponds to index 0 so we subtract 1
+            if (backreference >= 0) Emit(program, Op::Backreference, inTarget, digit, backreference);
+        }
+        else if (c == '_')
+        {
+            if (inTarget) continue;
+            Emit(program, Op::TargetStart, false);
+            int j = 0;
+            bool targetAfterTarget = false;
+            CompileSequence(target, j, 0, target, true, targetAfterTarget, categories, program);
+            Emit(program, Op::TargetEnd, false);
+            afterTarget = true;
+        }
+        else if (c == '#') Emit(program, boundary, inTarget);
+        else if (c == '>') Emit(program, Op::Repeat, inTarget);
+        else if (c == '~') continue;          // we ignore tildes in environment and target
+        else if (categories.IsCategory(c)) Emit(program, Op::Category, inTarget, c);
+        else Emit(program, Op::Char, inTarget, c);
+    }
+}
+
+void Matcher::Emit(Program &program, Op op, bool inTarget, QChar c, int x, int y, const QString &members)
+{
+    Instruction instruction;
+    instruction.op = op;
+    instruction.c = c;
+    instruction.members = members;
+    instruction.x = x;
+    instruction.y = y;
+    instruction.inTarget = inTarget;
+    program.append(instruction);
+}
+
+// Returns every character the first character consumed from pc can be, or an empty string if it could be anything
+QString Matcher::FirstSymbols(const Program &program, int pc, const CategoryTable &categories)
+{
+    QVector<bool> visited(program.length(), false);
+    QString symbols;
+    if (!FirstSymbols(program, pc, categories, visited, symbols)) return QString();
+    std::sort(symbols.begin(), symbols.end());
+    symbols.truncate(std::unique(symbols.begin(), symbols.end()) - symbols.begin());
+    return symbols;
+}
+
+// Adds the characters which can be consumed first from pc to symbols, following the same instructions as AddThread.
+// Returns false if it can't be known, because the character depends on earlier ones or nothing need be consumed.
+bool Matcher::FirstSymbols(const Program &program, int pc, const CategoryTable &categories, QVector<bool> &visited, QString &symbols)
+{
+    if (pc >= program.length()) return false;
+    if (visited.at(pc)) return true;
+    visited[pc] = true;
+
+    const Instruction &instruction = program.at(pc);
+    switch (instruction.op)
+    {
+    case Op::Split:
+    {
+        // an optional part can be skipped, so whatever comes after it can come first as well as the part itself
+        bool known = FirstSymbols(program, instruction.x, categories, visited, symbols);
+        return FirstSymbols(program, instruction.y, categories, visited, symbols) && known;
+    }
+    case Op::Jump:
+        return FirstSymbols(program, instruction.x, categories, visited, symbols);
+    case Op::StartBoundary:
+    case Op::EndBoundary:
+    case Op::Boundary:
+    case Op::NotNonce:
+    case Op::TargetStart:
+    case Op::TargetEnd:
+        return FirstSymbols(program, pc + 1, categories, visited, symbols);
+    case Op::Char:
+        symbols.append(instruction.c);
+        return true;
+    case Op::Category:
+        symbols.append(categories.Members(instruction.c));
+        return true;
+    case Op::Nonce:
+        symbols.append(instruction.members);
+        return true;
+    default:
+        return false;
+    }
+}
+
+// This is a Pike VM: every thread advances one character at a time, and a new thread is started at every position
+// of the word, so the whole word is covered in one pass. Threads are kept in priority order, so for each starting
+// position the match found is the one the greedy left-to-right reading of the environment would give.
+void Matcher::Run(const Program &program, const QString &first, const QString &word, const CategoryTable &categories, Workspace &workspace, Matches &result)
+{
+    int length = word.length();
+    result.at.fill(-1, length + 1);
+    result.matches.clear();
+    if (program.isEmpty()) return;
+
+    // Most rules only apply to a few words, so if the word has none of the characters a match can start with we
+    // stop before setting anything up
+    int firstPos = first.isEmpty() ? 0 : NextCandidate(word, 0, first);
+    if (firstPos == length && !first.isEmpty()) return;
+
+    QVector<Thread> &current = workspace.current;
+    QVector<Thread> &next = workspace.next;
+    current.clear();
+    next.clear();
+    // every value left in visited by earlier scans is below the new stamp, so it never needs clearing
+    workspace.stamp = workspace.nextStamp;
+    workspace.nextStamp += length + 1;
+    int size = program.length() * (length + 1);
+    if (workspace.visited.length() < size) workspace.visited.resize(size);
+    workspace.cut.fill(-1, length + 1);
+
+    for (int pos = firstPos; pos <= length; pos++)
+    {
+        // with no threads running, a match can only start at a character the program can start with, so we skip
+        // straight to the next one
+        if (current.isEmpty() && !first.isEmpty())
+        {
+            pos = NextCandidate(word, pos, first);
+            if (pos == length) break;
+        }
+
+        Thread start;
+        start.pc = 0;
+        start.start = pos;
+        start.targetStart = -1;
+        start.targetEnd = -1;
+        start.lastChar = ' ';
+        AddThread(program, word, current, workspace, pos, start);
+
+        QChar c = pos < length ? word.at(pos) : QChar();
+        for (int t = 0; t < current.length(); t++)
+        {
+            const Thread &thread = current.at(t);
+            if (workspace.cut.at(thread.start) == pos) continue;       // a higher priority thread with the same start has already matched
+
+            const Instruction &instruction = program.at(thread.pc);
+            if (instruction.op == Op::Match)
+            {
+                Match match;
+                if (thread.targetStart >= 0)
+                {
+                    match.targetStart = thread.targetStart;
+                    match.targetLength = thread.targetEnd - thread.targetStart;
+                }
+                match.catnums = thread.catnums;
+
+                // a match found later by a thread which is still running can only be of higher priority, so it replaces this one
+                int &m = result.at[thread.start];
+                if (m < 0)
+                {
+                    m = result.matches.length();
+                    result.matches.append(match);
+                }
+                else result.matches[m] = match;
+                workspace.cut[thread.start] = pos;
+                continue;
+            }
+            if (pos >= length) continue;
+
+            Thread advanced = thread;
+            bool matched = false;
+            switch (instruction.op)
+            {
+            case Op::Char:
+                matched = c == instruction.c;
+                advanced.lastChar = c;
+                break;
+            case Op::Category:
+            {
+                int index = categories.IndexOf(instruction.c, c);
+                matched = index >= 0;
+                if (!matched) break;
+                advanced.lastChar = c;
+                if (instruction.inTarget)
+                {
+                    advanced.targetcats.append(std::make_pair(instruction.c, index));
+                    advanced.catnums.append(std::make_pair(index, c));
+                }
+                else advanced.environmentcats.append(std::make_pair(instruction.c, index));
+                break;
+            }
+            case Op::Nonce:
+            {
+                int index = instruction.members.indexOf(c);
+                matched = index >= 0;
+                advanced.lastChar = c;
+                if (matched && instruction.inTarget) advanced.catnums.append(std::make_pair(index, c));
+                break;
+            }
+            case Op::Repeat:
+                matched = c == thread.lastChar;
+                break;
+            case Op::Backreference:
+            {
+                const QVarLengthArray<std::pair<QChar, int>, 8> &cats = instruction.inTarget ? thread.targetcats : thread.environmentcats;
+                if (instruction.x >= cats.length()) break;
+                std::pair<QChar, int> cat = cats.at(instruction.x);
+                matched = c == categories.Members(cat.first).at(cat.second);
+                if (matched && instruction.inTarget) advanced.catnums.append(std::make_pair(cat.second, instruction.c));
+                break;
+            }
+            default:
+                break;
+            }
+
+            if (matched)
+            {
+                advanced.pc++;
+                AddThread(program, word, next, workspace, pos + 1, advanced);
+            }
+        }
+
+        current.swap(next);
+        next.clear();
+    }
+}
+
+// Adds thread to list, following any instructions which don't consume a character
+void Matcher::AddThread(const Program &program, const QString &word, QVector<Thread> &list, Workspace &workspace, int pos, Thread thread)
+{
+    int length = word.length();
+    qint64 &visited = workspace.visited[thread.pc * (length + 1) + thread.start];
+    if (visited == workspace.stamp + pos) return;
+    visited = workspace.stamp + pos;
+
+    const Instruction &instruction = program.at(thread.pc);
+    switch (instruction.op)
+    {
+    case Op::Split:
+    {
+        Thread other = thread;
+        thread.pc = instruction.x;
+        AddThread(program, word, list, workspace, pos, thread);
+        other.pc = instruction.y;
+        AddThread(program, word, list, workspace, pos, other);
+        return;
+    }
+    case Op::Jump:
+        thread.pc = instruction.x;
+        AddThread(program, word, list, workspace, pos, thread);
+        return;
+    case Op::StartBoundary:
+        if (pos != 0) return;
+        break;
+    case Op::EndBoundary:
+        if (pos != length) return;
+        break;
+    case Op::Boundary:
+        if (pos != 0 && pos != length) return;
+        break;
+    case Op::NotNonce:
+        if (pos < length && instruction.members.contains(word.at(pos))) return;
+        break;
+    case Op::TargetStart:
+        thread.targetStart = pos;
+        break;
+    case Op::TargetEnd:
+        thread.targetEnd = pos;
+        break;
+    default:
+        list.append(thread);
+        return;
+    }
+
+    // all the instructions which fall through to here are zero-width, so we carry on to the next one
+    thread.pc++;
+    AddThread(program, word, list, workspace, pos, thread);
+}
@@ -0,0 +1,120 @@
+#ifndef MATCHER_H
+#define MATCHER_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QVarLengthArray>
+#include <utility>
+
+class CategoryTable;
+
+// A rule's environment, target and exceptions compiled into a small automaton over characters and categories.
+// Rather than re-parsing the environment at every position of the word, FindMatches scans the word once and
+// reports the match starting at every position. Optional parts, including nested ones, are tried greedily but
+// are backed out of properly if the rest of the environment doesn't match. Threads are kept for each position a
+// match could start at, so for a program of P instructions a word of length L takes O(P * L^2) time at worst; in
+// practice only the starts within the length of the environment are still running, so it is close to linear.
+class Matcher
+{
+public:
+    struct Match
+    {
+        int targetStart = 0;
+        int targetLength = 0;
+        QVarLengthArray<std::pair<int, QChar>, 8> catnums;     // the categories matched by the target, as (index, phoneme)
+    };
+
+    // at[i] is the index in matches of the match whose environment starts at position i, or -1 if there isn't one
+    struct Matches
+    {
+        QVector<int> at;
+        QVector<Match> matches;
+    };
+
+    struct Thread
+    {
+        int pc;
+        int start;
+        int targetStart;
+        int targetEnd;
+        QChar lastChar;
+        QVarLengthArray<std::pair<int, QChar>, 8> catnums;
+        QVarLengthArray<std::pair<QChar, int>, 8> environmentcats;     // for backreferences in the environment
+        QVarLengthArray<std::pair<QChar, int>, 8> targetcats;          // for backreferences in the target
+    };
+
+    // Working storage for FindMatches, kept between scans so they don't need to allocate
+    struct Workspace
+    {
+        QVector<Thread> current;
+        QVector<Thread> next;
+        QVector<qint64> visited;        // stamp + the position each (instruction, start) was last added at
+        qint64 stamp = 0;               // the base for this scan's positions in visited
+        qint64 nextStamp = 1;           // past every value an earlier scan can have left in visited
+        QVector<int> cut;
+        QVector<bool> blocked;
+        Matches exceptionMatches;
+    };
+
+    Matcher();
+    Matcher(const QString &environment, const QString &target, const QStringList &exceptions, const CategoryTable &categories);
+
+    void FindMatches(const QString &word, const CategoryTable &categories, Workspace &workspace, Matches &result) const;
+
+    // A bit for each character the environment can start with, numbered by the character modulo 64, or every bit if
+    // it can start with anything. If SymbolMask(word) has none of these bits, FindMatches can't find anything in word.
+    quint64 FirstMask() const { return m_firstMask; }
+    static quint64 SymbolMask(const QString &word);
+
+private:
+    enum class Op
+    {
+        Char,
+        Category,
+        Nonce,
+        NotNonce,           // a nonce category of the form '[~...]', which doesn't consume anything
+        StartBoundary,      // a '#' before the target
+        EndBoundary,        // a '#' after the target
+        Boundary,           // a '#' in the target itself, which can match either end
+        Repeat,             // '>'
+        Backreference,
+        Split,
+        Jump,
+        TargetStart,
+        TargetEnd,
+        Match
+    };
+
+    struct Instruction
+    {
+        Op op;
+        QChar c;            // the character for Char, the category for Category, or the digit of a Backreference
+        QString members;    // the members of a nonce category
+        int x;              // the preferred branch of a Split, the destination of a Jump, or the index of a Backreference
+        int y;              // the other branch of a Split
+        bool inTarget;
+    };
+
+    typedef QVector<Instruction> Program;
+
+    Program m_program;
+    QVector<Program> m_exceptions;
+
+    // The characters the environment and the exceptions can start with, sorted so they can be searched. If they are
+    // empty, anything can come first (for instance if the environment starts with an optional part).
+    QString m_environmentFirst;
+    quint64 m_firstMask = ~quint64(0);
+    QStringList m_exceptionFirst;
+
+    static Program Compile(const QString &pattern, const QString &target, const CategoryTable &categories);
+    static void CompileSequence(const QString &pattern, int &i, int depth, const QString &target, bool inTarget, bool &afterTarget, const CategoryTable &categories, Program &program);
+    static void Emit(Program &program, Op op, bool inTarget, QChar c = QChar(), int x = 0, int y = 0, const QString &members = QString());
+    static QString FirstSymbols(const Program &program, int pc, const CategoryTable &categories);
+    static bool FirstSymbols(const Program &program, int pc, const CategoryTable &categories, QVector<bool> &visited, QString &symbols);
+
+    static void Run(const Program &program, const QString &first, const QString &word, const CategoryTable &categories, Workspace &workspace, Matches &result);
+    static void AddThread(const Program &program, const QString &word, QVector<Thread> &list, Workspace &workspace, int pos, Thread thread);
+};
+
+#endif // MATCHER_H
@@ -0,0 +1,44 @@
+#ifndef ORDEREDSET_H
+#define ORDEREDSET_H
+
+#include <QSet>
+#include <QList>
+
+// A set which remembers the order its values were first inserted in. Inserting and looking up are both constant
+// time, unlike checking a list with contains() before appending to it.
+template <typename T>
+class OrderedSet
+{
+public:
+    // Returns false if value was already in the set, in which case it keeps its original place
+    bool Insert(const T &value)
+    {
+        int size = m_seen.size();
+        m_seen.insert(value);
+        if (m_seen.size() == size) return false;
+        m_values.append(value);
+        return true;
+    }
+
+    bool Contains(const T &value) const { return m_seen.contains(value); }
+    int Count() const { return m_values.length(); }
+    const QList<T> &Values() const { return m_values; }
+
+    void Reserve(int size)
+    {
+        m_seen.reserve(size);
+        m_values.reserve(size);
+    }
+
+    void Clear()
+    {
+        m_seen.clear();
+        m_values.clear();
+    }
+
+private:
+    QSet<T> m_seen;
+    QList<T> m_values;
+};
+
+#endif // ORDEREDSET_H
@@ -0,0 +1,155 @@
+#include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QVector>
+#include <QChar>
+#include <algorithm>
+#include "phonemeinventory.h"
+
+namespace
+{
+    // The characters which can be IDs, in the order they are given out. Noncharacters come first, since they should
+    // never appear in text at all; the private use area is only used once they run out.
+    QVector<ushort> Candidates()
+    {
+        QVector<ushort> candidates;
+        for (ushort c = 0xFDD0; c <= 0xFDEF; c++) candidates.append(c);
+        for (ushort c = 0xE000; c <= 0xF8FF; c++) candidates.append(c);
+        return candidates;
+    }
+}
+
+PhonemeInventory::PhonemeInventory()
+{
+}
+
+PhonemeInventory::PhonemeInventory(const QStringList &phonemes, const QString &ids) :
+    m_ids(ids.left(phonemes.length()))
+{
+    if (m_ids.length() < phonemes.length())
+    {
+        QVector<ushort> candidates = Candidates();
+        for (int i = 0; i < candidates.length() && m_ids.length() < phonemes.length(); i++)
+        {
+            if (!m_ids.contains(QChar(candidates.at(i)))) m_ids.append(QChar(candidates.at(i)));
+        }
+    }
+
+    m_phonemes = phonemes.mid(0, m_ids.length());
+    for (int id = 0; id < m_phonemes.length(); id++)
+    {
+        m_byId.insert(m_ids.at(id), id);
+        m_lowestId = qMin(m_lowestId, m_ids.at(id).unicode());
+        m_byFirst[m_phonemes.at(id).at(0)].append(id);
+    }
+    for (QVector<int> &ids : m_byFirst)
+    {
+        std::stable_sort(ids.begin(), ids.end(), [this](int a, int b) { return m_phonemes.at(a).length() > m_phonemes.at(b).length(); });
+    }
+}
+
+QStringList PhonemeInventory::Find(const QString &categories, const QString &rules)
+{
+    QStringList phonemes;
+    auto add = [&phonemes](const QString &phoneme)
+    {
+        if (phoneme.length() > 1 && !phonemes.contains(phoneme)) phonemes.append(phoneme);
+    };
+
+    for (int i = 0; i < categories.length(); i++)
+    {
+        if (categories.at(i) == '{')
+        {
+            int end = categories.indexOf('}', i + 1);
+            int newline = categories.indexOf('\n', i + 1);
+            if (end > i + 1 && (newline < 0 || end < newline))
+            {
+                add(categories.mid(i + 1, end - i - 1));
+                i = end;
+                continue;
+            }
+        }
+        if (categories.at(i).isHighSurrogate() && i + 1 < categories.length() && categories.at(i + 1).isLowSurrogate()) add(categories.mid(i++, 2));
+    }
+
+    // braces in rules can be part of a regexp, so only characters outside the BMP are taken from them
+    for (int i = 0; i + 1 < rules.length(); i++)
+    {
+        if (rules.at(i).isHighSurrogate() && rules.at(i + 1).isLowSurrogate()) add(rules.mid(i++, 2));
+    }
+    return phonemes;
+}
+
+QString PhonemeInventory::ChooseIds(int count, const QStringList &texts)
+{
+    QVector<bool> used(0x10000, false);
+    for (const QString &text : texts)
+    {
+        for (QChar c : text) used[c.unicode()] = true;
+    }
+
+    QString ids;
+    for (ushort c : Candidates())
+    {
+        if (ids.length() == count) break;
+        if (!used.at(c)) ids.append(QChar(c));
+    }
+    return ids;
+}
+
+QString PhonemeInventory::Tokenize(const QString &text) const
+{
+    if (m_phonemes.isEmpty()) return text;
+
+    QString tokens;
+    tokens.reserve(text.length());
+    for (int i = 0; i < text.length(); i++)
+    {
+        QChar c = text.at(i);
+        if (c == '{')
+        {
+            int end = text.indexOf('}', i + 1);
+            int id = end > i ? m_phonemes.indexOf(text.mid(i + 1, end - i - 1)) : -1;
+            if (id >= 0)
+            {
+                tokens.append(m_ids.at(id));
+                i = end;
+                continue;
+            }
+        }
+
+        bool found = false;
+        auto candidates = m_byFirst.constFind(c);
+        if (candidates != m_byFirst.constEnd())
+        {
+            for (int id : *candidates)
+            {
+                const QString &phoneme = m_phonemes.at(id);
+                if (text.midRef(i, phoneme.length()) == phoneme)
+                {
+                    tokens.append(m_ids.at(id));
+                    i += phoneme.length() - 1;
+                    found = true;
+                    break;
+                }
+            }
+        }
+        if (!found) tokens.append(c);
+    }
+    return tokens;
+}
+
+QString PhonemeInventory::Text(const QString &tokens) const
+{
+    if (m_phonemes.isEmpty()) return tokens;
+
+    QString text;
+    text.reserve(tokens.length());
+    for (QChar c : tokens)
+    {
+        auto id = c.unicode() >= m_lowestId ? m_byId.constFind(c) : m_byId.constEnd();
+        if (id != m_byId.constEnd()) text.append(m_phonemes.at(*id));
+        else text.append(c);
+    }
+    return text;
+}
@@ -0,0 +1,51 @@
+#ifndef PHONEMEINVENTORY_H
+#define PHONEMEINVENTORY_H
+
+#include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QVector>
+#include <QChar>
+
+// The phonemes which take more than one UTF-16 unit to write: multigraphs declared in the categories as '{th}', and
+// characters outside the BMP, which are written as surrogate pairs. Each is given a character of its own as an ID, so
+// the rest of the engine can go on treating every phoneme as one QChar. The IDs are taken from the noncharacters
+// U+FDD0-U+FDEF and then the private use area, leaving out any which are already used in the text. Words, rules and
+// categories are tokenized into these once, taking the longest phoneme at each position, and are only turned back
+// into text for output.
+class PhonemeInventory
+{
+public:
+    PhonemeInventory();
+
+    // If ids is shorter than phonemes, the first IDs not in it are used for the rest, so inventories built without
+    // any text to avoid still agree with each other.
+    explicit PhonemeInventory(const QStringList &phonemes, const QString &ids = QString());
+
+    // The multigraphs declared in categories and the characters outside the BMP in either, in the order they first
+    // appear. Building inventories from the same lists always gives the same IDs.
+    static QStringList Find(const QString &categories, const QString &rules);
+
+    // Chooses an ID for each of count phonemes which doesn't appear anywhere in texts. There may be fewer if the
+    // texts use up most of the private use area.
+    static QString ChooseIds(int count, const QStringList &texts);
+
+    const QStringList &Phonemes() const { return m_phonemes; }
+    const QString &Ids() const { return m_ids; }
+    bool IsEmpty() const { return m_phonemes.isEmpty(); }
+
+    // Replaces each phoneme in text with its ID. A phoneme can also be written in braces, as in the categories.
+    QString Tokenize(const QString &text) const;
+
+    // Replaces each ID in tokens with its phoneme
+    QString Text(const QString &tokens) const;
+
+private:
+    QStringList m_phonemes;
+    QString m_ids;                              // the ID of each phoneme
+    QHash<QChar, int> m_byId;                   // the phoneme with each ID
+    ushort m_lowestId = 0xFFFF;                 // so most characters can be passed over without looking them up
+    QHash<QChar, QVector<int>> m_byFirst;       // the phonemes starting with each character, longest first
+};
+
+#endif // PHONEMEINVENTORY_H
@@ -0,0 +1,105 @@
+#include <QAbstractListModel>
+#include <QStyledItemDelegate>
+#include <QApplication>
+#include <QStyle>
+#include <QPainter>
+#include <QTextDocument>
+#include <QAbstractTextDocumentLayout>
+#include <QFontMetrics>
+#include <QVariant>
+#include "resultmodel.h"
+#include "resultstore.h"
+#include "engine.h"
+#include "phonemeinventory.h"
+
+ResultModel::ResultModel(QObject *parent) : QAbstractListModel(parent)
+{
+}
+
+int ResultModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid()) return 0;
+    return m_store.Count();
+}
+
+QVariant ResultModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= m_store.Count()) return QVariant();
+
+    switch (role)
+    {
+    case Qt::DisplayRole:
+        return m_store.Format(index.row(), m_format, false);
+    case HtmlRole:
+        return m_store.Format(index.row(), m_format, m_markChanged);
+    default:
+        return QVariant();
+    }
+}
+
+void ResultModel::Clear()
+{
+    beginResetModel();
+    m_store.Clear();
+    endResetModel();
+}
+
+void ResultModel::Append(const QVector<Engine::Result> &results)
+{
+    if (results.isEmpty()) return;
+    beginInsertRows(QModelIndex(), m_store.Count(), m_store.Count() + results.length() - 1);
+    m_store.Append(results);
+    endInsertRows();
+}
+
+void ResultModel::SetFormat(Engine::Format format, bool markChanged)
+{
+    m_format = format;
+    m_markChanged = markChanged;
+    if (m_store.Count() > 0) emit dataChanged(index(0), index(m_store.Count() - 1));
+}
+
+void ResultModel::Filter(const QStringList &filters, const CategoryTable &categories, const PhonemeInventory &phonemes)
+{
+    m_store.Filter(filters, categories, phonemes);
+    if (m_store.Count() > 0) emit dataChanged(index(0), index(m_store.Count() - 1));
+}
+
+ResultDelegate::ResultDelegate(QObject *parent) : QStyledItemDelegate(parent)
+{
+}
+
+void ResultDelegate::paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const
+{
+    QStyleOptionViewItem opt = option;
+    initStyleOption(&opt, index);
+
+    // draw the background and selection as normal, then the text on top of it
+    QStyle *style = opt.widget ? opt.widget->style() : QApplication::style();
+    opt.text = QString();
+    style->drawControl(QStyle::CE_ItemViewItem, &opt, painter, opt.widget);
+
+    QTextDocument document;
+    document.setDefaultFont(opt.font);
+    document.setDocumentMargin(0);
+    document.setHtml(index.data(ResultModel::HtmlRole).toString());
+
+    QAbstractTextDocumentLayout::PaintContext context;
+    if (opt.state & QStyle::State_Selected) context.palette.setColor(QPalette::Text, opt.palette.color(QPalette::Active, QPalette::HighlightedText));
+    else                                    context.palette.setColor(QPalette::Text, opt.palette.color(QPalette::Active, QPalette::Text));
+
+    QRect textRect = style->subElementRect(QStyle::SE_ItemViewItemText, &opt, opt.widget);
+    painter->save();
+    painter->translate(textRect.topLeft());
+    painter->setClipRect(textRect.translated(-textRect.topLeft()));
+    document.documentLayout()->draw(painter, context);
+    painter->restore();
+}
+
+QSize ResultDelegate::sizeHint(const QStyleOptionViewItem &option, const QModelIndex &index) const
+{
+    // every line is the same height, so this doesn't need to lay out the text
+    QSize size = QStyledItemDelegate::sizeHint(option, index);
+    size.setHeight(qMax(size.height(), QFontMetrics(option.font).lineSpacing() + 2));
+    return size;
+}
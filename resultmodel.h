@@ -0,0 +1,54 @@
+#ifndef RESULTMODEL_H
+#define RESULTMODEL_H
+
+#include <QAbstractListModel>
+#include <QStyledItemDelegate>
+#include <QVector>
+#include <QStringList>
+#include "engine.h"
+#include "resultstore.h"
+
+class CategoryTable;
+class PhonemeInventory;
+
+// Shows a ResultStore in a list view. Lines are only formatted when the view asks for them, so only the visible
+// lines are ever formatted, and changing the format doesn't need to touch the stored results.
+class ResultModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+public:
+    enum Roles
+    {
+        HtmlRole = Qt::UserRole         // the line with changed words in bold, if markChanged is set
+    };
+
+    explicit ResultModel(QObject *parent = 0);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+
+    void Clear();
+    void Append(const QVector<Engine::Result> &results);
+    void SetFormat(Engine::Format format, bool markChanged);
+    void Filter(const QStringList &filters, const CategoryTable &categories, const PhonemeInventory &phonemes);
+
+private:
+    ResultStore m_store;
+    Engine::Format m_format = Engine::Format::Plain;
+    bool m_markChanged = true;
+};
+
+// Draws the HtmlRole of a ResultModel, so changed words can be shown in bold
+class ResultDelegate : public QStyledItemDelegate
+{
+    Q_OBJECT
+
+public:
+    explicit ResultDelegate(QObject *parent = 0);
+
+    void paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const override;
+    QSize sizeHint(const QStyleOptionViewItem &option, const QModelIndex &index) const override;
+};
+
+#endif // RESULTMODEL_H
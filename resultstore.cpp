@@ -0,0 +1,123 @@
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QAtomicInt>
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+#include <utility>
+#include "resultstore.h"
+#include "engine.h"
+#include "soundchanges.h"
+#include "categorytable.h"
+#include "phonemeinventory.h"
+
+void ResultStore::Clear()
+{
+    m_words.clear();
+    m_glosses.clear();
+    m_hasGloss.clear();
+    m_changed.clear();
+    m_subwordStarts.clear();
+    m_subwordInputs.clear();
+    m_subwordOutputs.clear();
+}
+
+void ResultStore::Append(const QVector<Engine::Result> &results)
+{
+    if (m_subwordStarts.isEmpty()) m_subwordStarts.append(0);
+    for (const Engine::Result &result : results)
+    {
+        m_words.append(result.word);
+        m_glosses.append(result.gloss);
+        m_hasGloss.append(result.hasGloss);
+        for (const std::pair<QString, QString> &subword : result.subwords)
+        {
+            m_subwordInputs.append(subword.first);
+            m_subwordOutputs.append(subword.second);
+        }
+        m_subwordStarts.append(m_subwordInputs.length());
+        m_changed.append(false);
+        UpdateChanged(m_words.length() - 1);
+    }
+}
+
+Engine::Result ResultStore::At(int row) const
+{
+    Engine::Result result;
+    result.word = m_words.at(row);
+    result.gloss = m_glosses.at(row);
+    result.hasGloss = m_hasGloss.at(row);
+    for (int i = m_subwordStarts.at(row); i < m_subwordStarts.at(row + 1); i++)
+    {
+        result.subwords.append(std::make_pair(m_subwordInputs.at(i), m_subwordOutputs.at(i)));
+    }
+    return result;
+}
+
+QString ResultStore::Format(int row, Engine::Format format, bool markChanged) const
+{
+    return Engine::FormatResult(At(row), format, markChanged);
+}
+
+namespace
+{
+    // Filters a share of the outputs; each worker takes the next block of outputs whenever it finishes one
+    class FilterWorker : public QRunnable
+    {
+    public:
+        FilterWorker(QString *outputs, int count, QAtomicInt &next, const SoundChanges::FilterSet &filters, const PhonemeInventory &phonemes) :
+            m_outputs(outputs), m_count(count), m_next(next), m_filters(filters), m_phonemes(phonemes)
+        {
+        }
+
+        void run() override
+        {
+            const int block = 256;
+            for (int start = m_next.fetchAndAddRelaxed(block); start < m_count; start = m_next.fetchAndAddRelaxed(block))
+            {
+                for (int i = start; i < qMin(start + block, m_count); i++)
+                {
+                    // the outputs are stored as text, so they are tokenized again to be compared with the categories
+                    QStringList forms = m_phonemes.Tokenize(m_outputs[i]).split(' ', QString::SkipEmptyParts);
+                    m_outputs[i] = m_phonemes.Text(SoundChanges::Filter(forms, m_filters).join(' '));
+                }
+            }
+        }
+
+    private:
+        QString *m_outputs;
+        int m_count;
+        QAtomicInt &m_next;
+        const SoundChanges::FilterSet &m_filters;
+        const PhonemeInventory &m_phonemes;
+    };
+}
+
+void ResultStore::Filter(const QStringList &filters, const CategoryTable &categories, const PhonemeInventory &phonemes)
+{
+    QStringList tokenized;
+    for (const QString &filter : filters) tokenized.append(phonemes.Tokenize(filter));
+    SoundChanges::FilterSet compiled = SoundChanges::CompileFilters(tokenized, categories);
+
+    // every output is only written by one worker, so they can all write into the same vector without locking
+    QString *outputs = m_subwordOutputs.data();
+    QAtomicInt next(0);
+    QThreadPool pool;
+    int threads = qBound(1, QThread::idealThreadCount(), qMax(1, m_subwordOutputs.length()));
+    pool.setMaxThreadCount(threads);
+    for (int i = 0; i < threads; i++) pool.start(new FilterWorker(outputs, m_subwordOutputs.length(), next, compiled, phonemes));
+    pool.waitForDone();
+
+    for (int row = 0; row < Count(); row++) UpdateChanged(row);
+}
+
+void ResultStore::UpdateChanged(int row)
+{
+    bool changed = false;
+    for (int i = m_subwordStarts.at(row); i < m_subwordStarts.at(row + 1); i++)
+    {
+        changed |= m_subwordOutputs.at(i) != m_subwordInputs.at(i);
+    }
+    m_changed[row] = changed;
+}
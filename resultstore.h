@@ -0,0 +1,41 @@
+#ifndef RESULTSTORE_H
+#define RESULTSTORE_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include "engine.h"
+
+class CategoryTable;
+class PhonemeInventory;
+
+// The results of a run, stored by column instead of as formatted text, so they can be shown in any format without
+// running the sound changes again
+class ResultStore
+{
+public:
+    void Clear();
+    void Append(const QVector<Engine::Result> &results);
+
+    int Count() const { return m_words.length(); }
+    bool Changed(int row) const { return m_changed.at(row); }
+
+    Engine::Result At(int row) const;
+    QString Format(int row, Engine::Format format, bool markChanged) const;
+
+    // Removes the forms matching any of filters from every output
+    void Filter(const QStringList &filters, const CategoryTable &categories, const PhonemeInventory &phonemes);
+
+private:
+    QVector<QString> m_words;
+    QVector<QString> m_glosses;
+    QVector<bool> m_hasGloss;
+    QVector<bool> m_changed;                // whether any subword of the line changed
+    QVector<int> m_subwordStarts;           // where each line's subwords start in the subword columns, plus the end of the last line
+    QVector<QString> m_subwordInputs;
+    QVector<QString> m_subwordOutputs;      // the space-seperated forms each subword changed to
+
+    void UpdateChanged(int row);
+};
+
+#endif // RESULTSTORE_H
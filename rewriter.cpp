@@ -0,0 +1,87 @@
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QPair>
+#include <QChar>
+#include <algorithm>
+#include "rewriter.h"
+
+Rewriter::Rewriter() :
+    m_nodes(1)
+{
+}
+
+Rewriter::Rewriter(const QStringList &rewrites, bool backwards) :
+    m_nodes(1)
+{
+    for (const QString &line : rewrites)
+    {
+        QStringList parts = line.split('>');
+        if (parts.length() != 2) continue;
+        const QString &from = backwards ? parts.at(1) : parts.at(0);
+        const QString &to   = backwards ? parts.at(0) : parts.at(1);
+        if (from.isEmpty()) continue;
+
+        int node = 0;
+        for (QChar c : from)
+        {
+            int child = Next(node, c);
+            if (child < 0)
+            {
+                child = m_nodes.length();
+                m_nodes.append(Node());
+                QVector<QPair<QChar, int>> &next = m_nodes[node].next;
+                QPair<QChar, int> edge(c, child);
+                next.insert(std::lower_bound(next.begin(), next.end(), edge), edge);
+            }
+            node = child;
+        }
+
+        // if two rules rewrite the same thing, the first one is used
+        if (m_nodes.at(node).replacement >= 0) continue;
+        m_nodes[node].replacement = m_replacements.length();
+        m_replacements.append(to);
+    }
+}
+
+int Rewriter::Next(int node, QChar c) const
+{
+    const QVector<QPair<QChar, int>> &next = m_nodes.at(node).next;
+    auto it = std::lower_bound(next.begin(), next.end(), qMakePair(c, 0));
+    if (it == next.end() || it->first != c) return -1;
+    return it->second;
+}
+
+QString Rewriter::Apply(const QString &str) const
+{
+    if (m_replacements.isEmpty()) return str;
+
+    QString rewritten;
+    rewritten.reserve(str.length());
+    int i = 0;
+    while (i < str.length())
+    {
+        // follow the trie as far as the string allows, remembering the longest rule found on the way
+        int node = 0;
+        int longest = -1;
+        int length = 0;
+        for (int j = i; j < str.length(); j++)
+        {
+            node = Next(node, str.at(j));
+            if (node < 0) break;
+            if (m_nodes.at(node).replacement >= 0)
+            {
+                longest = m_nodes.at(node).replacement;
+                length = j + 1 - i;
+            }
+        }
+
+        if (longest >= 0)
+        {
+            rewritten.append(m_replacements.at(longest));
+            i += length;
+        }
+        else rewritten.append(str.at(i++));
+    }
+    return rewritten;
+}
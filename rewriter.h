@@ -0,0 +1,38 @@
+#ifndef REWRITER_H
+#define REWRITER_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QPair>
+#include <QChar>
+
+// The rewrite rules compiled into a trie, so a string is rewritten in a single pass instead of once per rule. At
+// each position the longest rule which matches there is applied, and the text it produces isn't rewritten again,
+// so the result doesn't depend on the order of the rules.
+class Rewriter
+{
+public:
+    Rewriter();
+
+    // rewrites holds lines of the form 'from>to'; if backwards is set they are applied from 'to' to 'from'
+    explicit Rewriter(const QStringList &rewrites, bool backwards = false);
+
+    bool IsEmpty() const { return m_replacements.isEmpty(); }
+
+    QString Apply(const QString &str) const;
+
+private:
+    struct Node
+    {
+        QVector<QPair<QChar, int>> next;    // the child for each character, sorted by character
+        int replacement = -1;               // the index in m_replacements if a rule ends here
+    };
+
+    QVector<Node> m_nodes;                  // m_nodes[0] is the root
+    QStringList m_replacements;
+
+    int Next(int node, QChar c) const;
+};
+
+#endif // REWRITER_H
@@ -3,672 +3,441 @@
 #include <QString>
 #include <QStringList>
 #include <QChar>
-#include <QMap>
 #include <QList>
-#include <QQueue>
-#include <QStack>
+#include <QVector>
+#include <QVarLengthArray>
 #include <QRegularExpression>
 #include <QRegularExpressionMatch>
 #include <QRegularExpressionMatchIterator>
-#include <random>
+#include <QHash>
+#include <QPair>
+#include <QCache>
+#include <QMutex>
+#include <QMutexLocker>
 #include "soundchanges.h"
+#include "categorytable.h"
+#include "rewriter.h"
+#include "orderedset.h"
 
-QStringList SoundChanges::ApplyChange(QString word, QString change, QMap<QChar, QList<QChar>> categories, int probability, bool reverse, bool alwaysApply, bool sometimesApply)
+SoundChanges::Rule SoundChanges::CompileRule(QString line, const CategoryTable &categories)
 {
-    QStringList splitChange = change.split("/");
-    if (reverse) ReverseFirstTwo(splitChange);
-    QList<std::pair<QString, int>> replaced;
-    replaced.append(std::make_pair(word, 0));
+    Rule rule;
+    if (line.isEmpty()) return rule;
 
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_real_distribution<> rand;                 // used when rule begins with '?'
+    // We don't remove comments from regex rules, as '*' is a valid character in a regexp
+    // We need the second expression to account for cases like 'f _ax*b/c'
+    if ((line.at(0) != '_') && !line.contains(" _"))
+    {
+        int commentStart = line.indexOf('*');
+        if (commentStart >= 0) line.truncate(commentStart);
+    }
+
+    QStringList splitLine = line.split(' ', QString::SkipEmptyParts);
+    if (splitLine.length() == 0) return rule;
+    rule.key = splitLine.join(' ');
+
+    rule.change = splitLine.takeLast();
+    for (QString flag : splitLine)
+    {
+        switch (flag.at(0).toLatin1())
+        {
+        case 'x':
+            rule.syllabify = true;
+            break;
+        case '?':
+        {
+            bool ok;
+            int probability = flag.mid(1).toInt(&ok);
+            if (ok) rule.probability = probability;
+            break;
+        }
+        case 'f':
+            rule.forwardOnly = true;
+            break;
+        case 'b':
+            rule.backwardOnly = true;
+            break;
+        case 'a':
+            rule.alwaysApply = true;
+            break;
+        case 's':
+            rule.sometimesApply = true;
+            break;
+        }
+    }
+
+    QStringList splitChange = rule.change.split("/");
+    if (rule.change.at(0) == '_')
+    {
+        rule.isRegex = true;
+        rule.isValid = splitChange.length() == 2;
+        rule.target = splitChange.at(0).mid(1);
+        if (rule.isValid)
+        {
+            rule.replacement = splitChange.at(1);
+            rule.regexp = CompiledRegexp(rule.target, categories);
+        }
+    }
+    else if (splitChange.length() >= 3)
+    {
+        rule.isValid = true;
+        rule.target = splitChange.at(0);
+        rule.replacement = splitChange.at(1);
+        rule.environment = splitChange.at(2);
+
+        for (int i = 3; i < splitChange.length(); i++) rule.exceptions.append(splitChange.at(i));
+
+        rule.matcher = Matcher(rule.environment, rule.target, rule.exceptions, categories);
+        rule.reverseMatcher = Matcher(rule.environment, rule.replacement, rule.exceptions, categories);
+    }
+    return rule;
+}
+
+QList<SoundChanges::Rule> SoundChanges::CompileRules(QStringList lines, const CategoryTable &categories)
+{
+    QList<Rule> rules;
+    for (QString line : lines)
+    {
+        Rule rule = CompileRule(line, categories);
+        if (!rule.change.isEmpty()) rules.append(rule);
+    }
+    return rules;
+}
+
+bool SoundChanges::ApplyChange(const QString &word, const Rule &rule, const CategoryTable &categories, bool reverse, Scratch &scratch, RandomStream &random)
+{
+    return ApplyChange(word, rule, categories, rule.probability, reverse, rule.alwaysApply, rule.sometimesApply, scratch, random);
+}
+
+bool SoundChanges::ApplyChange(const QString &word, const Rule &rule, const CategoryTable &categories, int probability, bool reverse, bool alwaysApply, bool sometimesApply, Scratch &scratch, RandomStream &random)
+{
+    if (!rule.isValid || probability <= 0) return false;
+    bool deterministic = probability >= 100;              // if so, we don't need to draw any random numbers
+
+    // Regex rules replace every match in the word at once, so they only need to be run once per word
+    if (rule.isRegex)
+    {
+        if (reverse) return false;              // we can't reverse regexes yet, so we just return the original word
+        if (!deterministic && random.Next() >= (probability / 100.0)) return false;
+
+        QString replaced(word);
+        replaced.replace(rule.regexp, rule.replacement);
+        if (replaced == word) return false;
+        scratch.results.clear();
+        scratch.results.append(replaced);
+        if (sometimesApply) scratch.results.append(word);
+        return true;
+    }
+
+    const QString &replaceWith = reverse ? rule.target : rule.replacement;
+    const Matcher &matcher = reverse ? rule.reverseMatcher : rule.matcher;
+
+    // replaced and newReplaced are swapped after each position, so between them they only ever allocate once
+    QVector<Branch> &replaced = scratch.replaced;
+    QVector<Branch> &newReplaced = scratch.newReplaced;
+    QVector<QString> &replacements = scratch.replacements;
+    QVector<QString> &newReplacements = scratch.newReplacements;
+    CategoryQueue &catnums = scratch.catnums;
+    replaced.clear();
+    newReplaced.clear();
+    scratch.newBranches.clear();
+
+    // The word is scanned once here rather than in the loop, so a rule which doesn't match it at all (as most don't)
+    // can leave it alone straight away. In reverse mode the word still has to be checked forwards below.
+    if (scratch.matches.isEmpty()) scratch.matches.resize(1);
+    matcher.FindMatches(word, categories, scratch.workspace, scratch.matches[0]);
+    if (!reverse && scratch.matches.at(0).matches.isEmpty()) return false;
+    replaced.append(Branch{word, 0, 0});
+    int matchesUsed = 1;
 
     for (int wordIndex = 0; wordIndex <= MaxLength(replaced); wordIndex++) // '<=' and not '<' because material can be added to the end of the word (e.g. '/XYZ/_#')
     {
-        int startpos, length;
-        QQueue<std::pair<int, QChar>> catnums;
-        bool tryRule = true;
-        if (rand(gen) >= (probability / 100.0)) tryRule = false;
-        QList<std::pair<QString, int>> newReplaced;
-        for (std::pair<QString, int> _replaced : replaced)
+        bool tryRule = deterministic || (random.Next() < (probability / 100.0));
+        for (Branch &_replaced : replaced)
         {
-            int _wordIndex = _replaced.second;
-            if (_wordIndex > _replaced.first.length()) continue;
-            if (tryRule && SoundChanges::TryRule(_replaced.first, _wordIndex, change, categories, &startpos, &length, &catnums, reverse))
+            int _wordIndex = _replaced.index;
+            if (!tryRule || _wordIndex > _replaced.word.length()) continue;
+
+            // Each word is only scanned once, which finds the match at every position; it is only scanned again once it has been changed
+            if (_replaced.matches < 0)
             {
-                if (change.at(0) == '_')
-                {
-                    if (splitChange.length() == 2)
-                    {
-                        if (reverse) newReplaced.append(_replaced);  // we can't reverse regexes yet, so we just re-add the original word
-                        else
-                        {
-                            QRegularExpression regexp = QRegularExpression(PreProcessRegexp(splitChange.at(0).mid(1), categories));
-                            // so 'first.replace()' doesn't modify _replaced.first
-                            QString temp(_replaced.first);
-                            newReplaced.append(std::make_pair(temp.replace(regexp, splitChange.at(1)), _replaced.second));
-                        }
-                    }
-                }
-                else
+                if (matchesUsed == scratch.matches.length()) scratch.matches.resize(matchesUsed + 1);
+                _replaced.matches = matchesUsed++;
+                matcher.FindMatches(_replaced.word, categories, scratch.workspace, scratch.matches[_replaced.matches]);
+            }
+            const Matcher::Matches &matches = scratch.matches.at(_replaced.matches);
+            int m = matches.at.at(_wordIndex);
+            if (m >= 0)
+            {
+                const Matcher::Match &match = matches.matches.at(m);
+                int startpos = match.targetStart;
+                int length = match.targetLength;
+                catnums.clear();
+                for (const std::pair<int, QChar> &catnum : match.catnums) catnums.enqueue(catnum);
+
+                replacements.resize(1);
+                replacements[0].truncate(0);
+                newReplacements.clear();
+                QChar lastChar = ' ';
+                QVarLengthArray<QChar, 16> backreferences;
+                State state = State::Normal;
+                int nonceStart = 0;
+                bool insertMultiple = false;
+
+                for (int j = 0; j < replaceWith.length(); j++)
                 {
-                    QStringList replacements("");
-                    QStringList newReplacements;
-                    QChar lastChar = ' ';
-                    QList<QChar> backreferences;
-                    State state = State::Normal;
-                    QList<QChar> nonceChars;
-                    bool insertMultiple = false;
-
-                    for (QChar c : splitChange.at(1))
+                    QChar c = replaceWith.at(j);
+                    switch (state)
                     {
-                        int i = 0;
-                        for (QString &replacement : replacements)
+                    case State::Normal:
+                        if (categories.IsCategory(c))
                         {
-                            switch (state)
+                            const QString &members = categories.Members(c);
+                            for (QString &replacement : replacements)
                             {
-                            case State::Normal:
-                                if (categories.contains(c))
+                                if ((catnums.length() > 0) && (!insertMultiple))
                                 {
-                                    if ((catnums.length() > 0) && (!insertMultiple))
-                                    {
-                                        QChar c1;
-                                        std::pair<int, QChar> deq = catnums.dequeue();
-                                        if (i != replacements.length()) catnums.enqueue(deq);
-                                        if (categories.value(c).length() > deq.first) c1 = categories.value(c).at(deq.first);
-                                        else c1 = deq.second;
-
-                                        replacement.append(c1);
-                                        lastChar = c1;
-                                        backreferences.append(c1);
-                                    }
-                                    else
-                                    {
-                                        for (QChar c1 : categories.value(c))
-                                        {
-                                            newReplacements.append(replacement + c1);
-                                        }
-                                    }
-                                    insertMultiple = false;
-                                    i++;
+                                    QChar c1;
+                                    std::pair<int, QChar> deq = catnums.dequeue();
+                                    catnums.enqueue(deq);
+                                    if (members.length() > deq.first) c1 = members.at(deq.first);
+                                    else c1 = deq.second;
+
+                                    replacement.append(c1);
+                                    lastChar = c1;
+                                    backreferences.append(c1);
                                 }
-                                else if (c == '\\')
+                                else
                                 {
-                                    QString wordSegment = word.mid(startpos, length);
-                                    for (int i = wordSegment.length() - 1; i >= 0; i--)
+                                    for (QChar c1 : members)
                                     {
-                                        replacement.append(wordSegment.at(i));
+                                        newReplacements.append(replacement + c1);
                                     }
-                                    lastChar = wordSegment.at(wordSegment.length() - 1);
                                 }
-                                else if (c == '>')
+                            }
+                            insertMultiple = false;
+                        }
+                        else if (c == '\\')
+                        {
+                            if (length == 0) break;
+                            for (QString &replacement : replacements)
+                            {
+                                for (int i = startpos + length - 1; i >= startpos; i--)
                                 {
-                                    replacement.append(lastChar);
-                                    // no change in lastChar
+                                    replacement.append(_replaced.word.at(i));
                                 }
-                                else if (c == '~') catnums.dequeue();
-                                else if (c == '@') state = State::Backreference;
-                                else if (c == '[') state = State::Nonce;
-                                else if (c == '`') insertMultiple = true;
-                                else
+                            }
+                            lastChar = _replaced.word.at(startpos + length - 1);
+                        }
+                        else if (c == '>')
+                        {
+                            for (QString &replacement : replacements) replacement.append(lastChar);
+                            // no change in lastChar
+                        }
+                        else if (c == '~')
+                        {
+                            if (catnums.length() > 0) catnums.dequeue();
+                        }
+                        else if (c == '@') state = State::Backreference;
+                        else if (c == '[')
+                        {
+                            state = State::Nonce;
+                            nonceStart = j + 1;
+                        }
+                        else if (c == '`') insertMultiple = true;
+                        else
+                        {
+                            for (QString &replacement : replacements) replacement.append(c);
+                            lastChar = c;
+                        }
+                        break;
+                    case State::Nonce:
+                        if (c == ']')
+                        {
+                            CategoryTable::Nonce parsedChars = categories.ParseNonce(replaceWith.midRef(nonceStart, j - nonceStart));
+                            for (QString &replacement : replacements)
+                            {
+                                if ((catnums.length() > 0) && (!insertMultiple))
                                 {
-                                    replacement.append(c);
-                                    lastChar = c;
+                                    QChar c1;
+                                    std::pair<int, QChar> deq = catnums.dequeue();
+                                    if (parsedChars.members.length() > deq.first) c1 = parsedChars.members.at(deq.first);
+                                    else c1 = deq.second;
+
+                                    replacement.append(c1);
+                                    lastChar = c1;
+                                    backreferences.append(c1);
                                 }
-                                break;
-                            case State::Nonce:
-                                if (c == ']')
+                                else
                                 {
-                                    std::pair<QString, bool> parsedChars = SoundChanges::ParseNonce(nonceChars, categories);
-                                    if ((catnums.length() > 0) && (!insertMultiple))
+                                    for (QChar c1 : parsedChars.members)
                                     {
-                                        QChar c1;
-                                        std::pair<int, QChar> deq = catnums.dequeue();
-                                        if (parsedChars.first.length() > deq.first) c1 = parsedChars.first.at(deq.first);
-                                        else c1 = deq.second;
-
-                                        replacement.append(c1);
-                                        lastChar = c1;
-                                        backreferences.append(c1);
-                                        nonceChars = QList<QChar>();
+                                        newReplacements.append(replacement + c1);
                                     }
-                                    else
-                                    {
-                                        for (QChar c1 : parsedChars.first)
-                                        {
-                                            newReplacements.append(replacement + c1);
-                                        }
-                                    }
-                                    state = State::Normal;
-                                }
-                                else nonceChars.append(c);
-                                break;
-                            case State::Optional: break;
-                            case State::Backreference:
-                                bool ok = false;
-                                int backreference = QString(c).toInt(&ok) - 1;  // We start at '@1' but this corresponds to index 0 so we subtract 1
-                                if (ok)
-                                {
-                                    replacement.append(backreferences.at(backreference));
                                 }
-                                state = State::Normal;
-                                break;
                             }
+                            state = State::Normal;
                         }
-
-                        if (newReplacements.length() > 0)
+                        break;
+                    case State::Backreference:
+                        int backreference = c.digitValue() - 1;  // We start at '@1' but this corresponds to index 0 so we subtract 1
+                        if (backreference >= 0 && backreference < backreferences.length())
                         {
-                            replacements = newReplacements;
-                            newReplacements = QStringList();
+                            for (QString &replacement : replacements) replacement.append(backreferences.at(backreference));
                         }
+                        state = State::Normal;
+                        break;
                     }
 
-                    for (QString replacement : replacements)
+                    if (newReplacements.length() > 0)
                     {
-                        // so 'first.replace()' doesn't modify _replaced.first
-                        QString first(_replaced.first);
-                        QString replaced = first.replace(startpos, length, replacement);
-                        newReplaced.append(std::make_pair(replaced, _replaced.second + replacement.length() - length + 1));
+                        replacements.swap(newReplacements);
+                        newReplacements.clear();
                     }
                 }
-                if ((reverse && !alwaysApply) || sometimesApply) newReplaced.append(std::make_pair(_replaced.first, _replaced.second + 1));
+
+                for (const QString &replacement : replacements)
+                {
+                    // copying _replaced.word is cheap, as the data is only copied by 'replace()'
+                    QString first(_replaced.word);
+                    first.replace(startpos, length, replacement);
+                    AddBranch(scratch, Branch{first, _replaced.index + replacement.length() - length + 1, -1});
+                }
+                if ((reverse && !alwaysApply) || sometimesApply) AddBranch(scratch, Branch{_replaced.word, _replaced.index + 1, _replaced.matches});
             }
         }
 
         if (newReplaced.length() == 0)
         {
             // even if we aren't replacing anything, we still need to make sure we add one to the current position
-            for (std::pair<QString, int> _replaced : replaced)
-            {
-                newReplaced.append(std::make_pair(_replaced.first, _replaced.second + 1));
-            }
+            for (Branch &_replaced : replaced) _replaced.index++;
         }
-        replaced = newReplaced;
-        newReplaced = QList<std::pair<QString, int>>();
-    }
-
-    QStringList result;
-    for (std::pair<QString, int> _replaced : replaced)
-    {
-        bool append = true;
-        if (reverse)
+        else
         {
-            QStringList l = SoundChanges::ApplyChange(_replaced.first, change, categories, probability, false, false, false);
-            append = (l.length() == 1) && (l.at(0) == word);
+            replaced.swap(newReplaced);
+            newReplaced.clear();
+            scratch.newBranches.clear();
         }
-        if (append) result.append(_replaced.first);
-    }
-    return result;
-}
-
-bool SoundChanges::TryRule(QString word,
-                           int wordIndex,
-                           QString change,
-                           QMap<QChar, QList<QChar>> categories,
-                           int *startpos,
-                           int *length,
-                           QQueue<std::pair<int, QChar>> *catnums,
-                           bool reverse)
-{
-    QStringList splitChange = change.split("/");
-    if (change.at(0) == '_')
-    {
-        QRegularExpression regexp = QRegularExpression(PreProcessRegexp(splitChange.at(0).mid(1), categories));
-        return regexp.match(word).hasMatch();
-    }
-    else if (splitChange.length() >= 3)
-    {
-        if (reverse) ReverseFirstTwo(splitChange);
-        if (splitChange.length() > 2)
-        {
-            for (int i = 3; i < splitChange.length(); i++)
-            {
-                QStringList splitException = splitChange.at(i).split("_");
-                int beforePartLength        = SoundChanges::ActualLength(splitException              .at(0));
-                int beforeEnvironmentLength = SoundChanges::ActualLength(splitChange.at(2).split("_").at(0));
-                if (SoundChanges::TryCharacters(word,
-                                                wordIndex + (beforeEnvironmentLength - beforePartLength),
-                                                0,
-                                                splitException.at(0),
-                                                splitChange.at(0),
-                                                categories,
-                                                0,
-                                                0,
-                                                0,
-                                                false,
-                                                0))
-                {
-                    if (SoundChanges::TryCharacters(word,
-                                                    wordIndex + beforeEnvironmentLength,
-                                                    0,
-                                                    "_" + splitException.at(1),
-                                                    splitChange.at(0),
-                                                    categories,
-                                                    0,
-                                                    0,
-                                                    0,
-                                                    false,
-                                                    0))
-                    {
-                        return false;
-                    }
-                }
-            }
-        }
-
-        return SoundChanges::TryCharacters(word,
-                                           wordIndex,
-                                           0,
-                                           splitChange.at(2),
-                                           splitChange.at(0),
-                                           categories,
-                                           startpos,
-                                           length,
-                                           catnums,
-                                           false,
-                                           0);
-    }
-    else return false;
-}
-
-bool SoundChanges::TryCharacters(QString word,
-                                 int wordIndex,
-                                 int *finalIndex,
-                                 QString chars,
-                                 QString target,
-                                 QMap<QChar, QList<QChar>> categories,
-                                 int *startpos,
-                                 int *length,
-                                 QQueue<std::pair<int, QChar>> *outcats,
-                                 bool recordcats,
-                                 QChar *lastCharParsed)
-{
-    if (startpos) *startpos = 0;
-    if (length)   *length   = 0;
-    bool doesChangeApply = true;
-    int curIndex = wordIndex;         // Place in word we are currently at
-
-    State curState = State::Normal;
-    QStack<std::pair<int, bool>> opt_stateStack;  // For when we are in a state of State::Optional, this records the index we are currently at
-                                                  // and the current value of doesChangeApply. When we encounter a '(' we push curIndex and
-                                                  // and doesChangeApply, and if the optional part fails we pop them back off.
-
-    QList<QChar> nonceChars;
-    QChar lastChar = ' ';
-    QQueue<std::pair<QChar, int>> environmentcats;     // Categories encountered so far
-
-    // THE SPECIAL CASES '/XYZ/#_' and '/XYZ/_#'
-    // =========================================
-    //
-    // The expressions '/XYZ/#_' and '/XYZ/_#' should add XYZ to the beginning and the end of the word respectively.
-    // However, without special treatment, they both add XYZ to both the beginning and the end of the word, meaning
-    // that they have to be treated seperately from all other cases.
-    if (chars == "_#")
-    {
-        doesChangeApply &= SoundChanges::TryCharacter
-                                        (word,
-                                        '_',
-                                        lastChar,
-                                        &lastChar,
-                                        target,
-                                        curIndex,
-                                        categories,
-                                        startpos,
-                                        length,
-                                        outcats,
-                                        recordcats);
-        doesChangeApply &= curIndex == word.length();
-        return doesChangeApply;
-    }
-    else if (chars == "#_")
-    {
-        doesChangeApply &= curIndex == 0;
-        doesChangeApply &= SoundChanges::TryCharacter
-                                        (word,
-                                        '_',
-                                        lastChar,
-                                        &lastChar,
-                                        target,
-                                        curIndex,
-                                        categories,
-                                        startpos,
-                                        length,
-                                        outcats,
-                                        recordcats);
-        return doesChangeApply;
     }
 
-    for (QChar c : chars)
+    QVector<QString> &results = scratch.results;
+    results.clear();
+    for (const Branch &_replaced : replaced)
     {
-        switch (curState)
+        bool append = true;
+        if (reverse)
         {
-        case State::Normal:
-            if (c == '(')
-            {
-                opt_stateStack.push(std::make_pair(curIndex, doesChangeApply));
-                curState = State::Optional;
-                break;
-            }
-            else if (c == '[')
-            {
-                curState = State::Nonce;
-                break;
-            }
-            else if (c == '@')
-            {
-                curState = State::Backreference;
-                break;
-            }
-
-            if (categories.contains(c))
-            {
-                for (int i = 0; i < categories.value(c).length(); i++)
-                {
-                    if (curIndex < 0 || curIndex >= word.length()) return false;
-                    if (word.at(curIndex) == categories.value(c).at(i))
-                    {
-                        environmentcats.enqueue(std::make_pair(c, i));
-                        break;
-                    }
-                }
-            }
-            doesChangeApply &= SoundChanges::TryCharacter
-                                            (word,
-                                             c,
-                                             lastChar,
-                                             &lastChar,
-                                             target,
-                                             curIndex,
-                                             categories,
-                                             startpos,
-                                             length,
-                                             outcats,
-                                             recordcats);
-            break;
-        case State::Optional:
-            if (c == ')')
+            // The same candidates come up again and again, both for one word and across the lexicon, so the
+            // results are kept; this only works if the result isn't random, though
+            QPair<const Rule *, QString> key(&rule, _replaced.word);
+            const QStringList *forward = deterministic ? scratch.forwardResults.object(key) : nullptr;
+            QStringList l;
+            if (forward) l = *forward;
+            else
             {
-                if (!doesChangeApply)
+                if (!scratch.forward) scratch.forward.reset(new Scratch);
+                if (SoundChanges::ApplyChange(_replaced.word, rule, categories, probability, false, false, false, *scratch.forward, random))
                 {
-                    std::pair<int, bool> prevState = opt_stateStack.pop();
-                    curIndex = prevState.first;
-                    doesChangeApply = prevState.second;
+                    for (const QString &s : scratch.forward->results) l.append(s);
                 }
-                if (opt_stateStack.length() == 0) curState = State::Normal;
-                break;
-            }
-            else if (c == '(')
-            {
-                opt_stateStack.push(std::make_pair(curIndex, doesChangeApply));
-                break;
-            }
-            doesChangeApply &= SoundChanges::TryCharacter
-                                            (word,
-                                             c,
-                                             lastChar,
-                                             &lastChar,
-                                             target,
-                                             curIndex,
-                                             categories,
-                                             startpos,
-                                             length,
-                                             outcats,
-                                             recordcats);
-            break;
-        case State::Nonce:
-            if (c == ']')
-            {
-                int position = curIndex;                     // SoundChanges::TryCharacter changes the value of curIndex
-                                                             // so if it returns false we can reset it back to position
-
-                int resetPosition = curIndex;                // Index to reset to when done
-
-                bool didAnyApply = false;
-
-                std::pair<QString, bool> parsedChars = SoundChanges::ParseNonce(nonceChars, categories);
-
-                for (int i = 0; i < parsedChars.first.length(); i++)
+                else l.append(_replaced.word);
+                if (deterministic)
                 {
-                    QChar c_nonce = parsedChars.first.at(i);;
-                    QChar nonceCharParsed = ' ';
-                    QQueue<std::pair<int, QChar>> _outcats;
-                    if (SoundChanges::TryCharacter(word, c_nonce, lastChar, &nonceCharParsed, target, curIndex, categories, 0, 0, &_outcats, recordcats))
-                    {
-                        didAnyApply = true;
-                        lastChar = nonceCharParsed;
-                        resetPosition = curIndex;
-                        if (recordcats && outcats)
-                        {
-                            if (_outcats.length() > 0) outcats->append(std::make_pair(_outcats.dequeue().first, c_nonce));
-                            else                       outcats->enqueue(std::make_pair(i, c_nonce));
-                        }
-                        break;
-                    }
-                    curIndex = position;
+                    int cost = _replaced.word.length() + 1;
+                    for (const QString &s : l) cost += s.length() + 1;
+                    scratch.forwardResults.insert(key, new QStringList(l), cost);
                 }
-
-                if (parsedChars.second) doesChangeApply &= didAnyApply;
-                else                    doesChangeApply &= !didAnyApply;
-                curIndex = resetPosition;
-                curState = State::Normal;
-                nonceChars = QList<QChar>();
-                break;
             }
-            nonceChars.append(c);
-            break;
-        case State::Backreference:
-            bool ok = false;
-            int backreference = QString(c).toInt(&ok) - 1;     // We start at '@1' but this corresponds to index 0 so we subtract 1
-            if (ok)
-            {
-                if (curIndex >= word.length() || curIndex < 0) return false;
-                if (backreference >= environmentcats.length()) return false;
-                QChar c1 = categories.value(environmentcats.at(backreference).first).at(environmentcats.at(backreference).second);
-                doesChangeApply &= word.at(curIndex) == c1;
-                if (recordcats && outcats) outcats->enqueue(std::make_pair(environmentcats.at(backreference).second, c));
-                curIndex++;
-            }
-            curState = State::Normal;
-            break;
+            append = (l.length() == 1) && (l.at(0) == word);
         }
+        if (append) results.append(_replaced.word);
     }
-    if (finalIndex) *finalIndex = curIndex;
-    if (lastCharParsed) *lastCharParsed = lastChar;
-    return doesChangeApply;
+    return results.length() != 1 || results.at(0) != word;
 }
 
-bool SoundChanges::TryCharacter(QString word,
-                                QChar c,
-                                QChar lastChar,
-                                QChar *lastCharParsed,
-                                QString target,
-                                int &curIndex,
-                                QMap<QChar, QList<QChar>> categories,
-                                int *startpos,
-                                int *length,
-                                QQueue<std::pair<int, QChar>> *outcats,
-                                bool recordcats)
-    // we pass startpos, length, outcats by reference so we can pass a null pointer if we don't need them
+SoundChanges::ScratchPool::~ScratchPool()
 {
-    bool doesChangeApply = true;
-
-    switch (c.toLatin1())
-    {
-    case '#':
-        doesChangeApply &= (curIndex == 0) || (curIndex == word.length());
-        if ((curIndex != 0) && doesChangeApply)     // if we are at the last character
-            return true;                            // return immediately to avoid errors
-        break;
-    case '_':
-        if (startpos) *startpos = curIndex;
-        doesChangeApply &= SoundChanges::TryCharacters(word, curIndex, &curIndex, target, target, categories, 0, 0, outcats, true, lastCharParsed);
-        if (length && startpos) *length = curIndex - *startpos;
-        break;
-    case '>':
-        if (curIndex >= word.length() || curIndex < 0) return false;
-        doesChangeApply &= word.at(curIndex) == lastChar;
-        *lastCharParsed = lastChar;
-        curIndex++;
-        break;
-    case '~':
-        break;          // we ignore tildes in environment and target
-    default:
-        int catnum;
-        if (curIndex >= word.length() || curIndex < 0) return false;
-        doesChangeApply &= SoundChanges::MatchChar(word.at(curIndex), c, categories, &catnum);
-        if (categories.contains(c) && recordcats && outcats) outcats->enqueue(std::make_pair(catnum, categories.value(c).at(catnum)));
-        *lastCharParsed = word.at(curIndex);
-        curIndex++;
-        break;
-    }
-    return doesChangeApply;
+    qDeleteAll(m_free);
 }
 
-// we pass catnum by reference so we can pass a pointer if we don't need it
-bool SoundChanges::MatchChar(QChar char1, QChar char2, QMap<QChar, QList<QChar>> categories, int *catnum)
+SoundChanges::Scratch *SoundChanges::ScratchPool::Take()
 {
- 
-    if (catnum) *catnum = 0;
-    if (categories.contains(char2))
-    {
-        for (int i = 0; i < categories.value(char2).length(); i++)
-        {
-            if (char1 == categories.value(char2).at(i))
-            {
-                if (catnum) *catnum = i;
-                return true;
-            }
-        }
-        return false;
-    }
-    return char1 == char2;
+    QMutexLocker locker(&m_mutex);
+    if (m_free.isEmpty()) return new Scratch;
+    return m_free.takeLast();
 }
 
-std::pair<QString, bool> SoundChanges::ParseNonce(QList<QChar> nonce, QMap<QChar, QList<QChar>> categories)
+void SoundChanges::ScratchPool::Return(Scratch *scratch)
 {
-    QList<QChar> beforeTilde, afterTilde;
-    bool hasTildeOcurred = false;
+    QMutexLocker locker(&m_mutex);
+    m_free.append(scratch);
+}
 
-    for (QChar c : nonce)
+// Adds branch to the words for the next position, unless the same word has already been added at the same index
+void SoundChanges::AddBranch(Scratch &scratch, const Branch &branch)
+{
+    QPair<QString, int> key(branch.word, branch.index);
+    if (scratch.newBranches.contains(key)) return;
+    if (scratch.branchLimit > 0 && scratch.newReplaced.length() >= scratch.branchLimit)
     {
-        switch (c.toLatin1())
-        {
-        case '~':
-            hasTildeOcurred = true;
-            break;
-        default:
-            if (categories.contains(c))
-            {
-                QList<QChar> cl = categories.value(c);
-                for (QChar _c : cl)
-                {
-                    if (hasTildeOcurred) afterTilde .append(_c);
-                    else                 beforeTilde.append(_c);
-                }
-            }
-            else
-            {
-                if (hasTildeOcurred) afterTilde .append(c);
-                else                 beforeTilde.append(c);
-            }
-        }
+        scratch.truncated = true;
+        return;
     }
+    scratch.newBranches.insert(key);
+    scratch.newReplaced.append(branch);
+}
 
-    QString result;
-    for (QChar c : beforeTilde)
-    {
-        if (afterTilde.contains(c)) continue;
-        result.append(c);
-    }
+// splitmix64, which is used both to derive keys for substreams and to turn the counter into random bits
+static quint64 Mix(quint64 x)
+{
+    x += Q_UINT64_C(0x9E3779B97F4A7C15);
+    x = (x ^ (x >> 30)) * Q_UINT64_C(0xBF58476D1CE4E5B9);
+    x = (x ^ (x >> 27)) * Q_UINT64_C(0x94D049BB133111EB);
+    return x ^ (x >> 31);
+}
 
-    return std::make_pair(result, beforeTilde.length() != 0);
+SoundChanges::RandomStream::RandomStream(quint64 seed) : m_key(Mix(seed)), m_counter(0)
+{
 }
 
-int SoundChanges::ActualLength(QString rule)
+SoundChanges::RandomStream SoundChanges::RandomStream::Substream(quint64 id) const
 {
-    int length = 0;
-    State curState = State::Normal;
+    RandomStream result;
+    result.m_key = Mix(m_key ^ Mix(id));
+    return result;
+}
 
-    for (QChar c : rule)
-    {
-        switch (curState)
-        {
-        case State::Normal:
-            switch (c.toLatin1())
-            {
-            case '(':
-                curState = State::Optional;
-                break;
-            case '[':
-                curState = State::Nonce;
-                break;
-            case '@':
-                curState = State::Backreference;
-                break;
-            case '#':
-                break;
-            default:
-                length += 1;
-                break;
-            }
-        case State::Optional:
-            if (c == ')')
-            {
-                curState = State::Normal;
-                break;
-            }
-            // we shouldn't have an optional part before an '_' in a rule exception, so we just do nothing
-            break;
-        case State::Nonce:
-            if (c == ']')
-            {
-                length += 1;
-                curState = State::Normal;
-                break;
-            }
-            break;
-        case State::Backreference:
-            length += 1;
-            break;
-        }
-    }
-    return length;
+double SoundChanges::RandomStream::Next()
+{
+    quint64 bits = Mix(m_key + Q_UINT64_C(0x9E3779B97F4A7C15) * ++m_counter);
+    return (bits >> 11) * (1.0 / Q_UINT64_C(9007199254740992));    // use the top 53 bits, as that is all a double can hold
 }
 
-int SoundChanges::MaxLength(QList<std::pair<QString, int>> l)
+int SoundChanges::MaxLength(const QVector<Branch> &l)
 {
     int maxLength = 0;
-    for (std::pair<QString, int> s : l)
+    for (const Branch &s : l)
     {
-        int length = s.first.length();
+        int length = s.word.length();
         if (length > maxLength) maxLength = length;
     }
     return maxLength;
 }
 
-void SoundChanges::ReverseFirstTwo(QStringList &l)
+QString SoundChanges::ApplyRewrite(QString str, const QStringList &rewrites, bool backwards)
 {
-    if (l.length() >= 2)
-    {
-        QString t = l.at(0);
-        l[0] = l.at(1);
-        l[1] = t;
-    }
+    return Rewriter(rewrites, backwards).Apply(str);
 }
 
-QString SoundChanges::PreProcessRegexp(QString regexp, QMap<QChar, QList<QChar>> categories)
+QString SoundChanges::PreProcessRegexp(QString regexp, const CategoryTable &categories)
 {
     QString result = "";
     for (QChar c : regexp)
     {
-        if (categories.contains(c))
+        if (categories.IsCategory(c))
         {
             result.append('[');
-            for (QChar d : categories.value(c))
-            {
-                result.append(d);
-            }
+            result.append(categories.Members(c));
             result.append(']');
         }
         else result.append(c);
@@ -676,59 +445,127 @@ QString SoundChanges::PreProcessRegexp(QString regexp, QMap<QChar, QList<QChar>>
     return result;
 }
 
-QString SoundChanges::Syllabify(QString regexp, QString word, QChar seperator)
+QRegularExpression SoundChanges::CompiledRegexp(const QString &regexp, const CategoryTable &categories)
 {
-    QString result = "";
-    QRegularExpression _regexp('^' + regexp);
-    QRegularExpressionMatch match = _regexp.match(word);
-    bool first = true;
-    while (match.hasMatch())
+    // The cache is shared between runs, so it is keyed on the category version as well as the pattern
+    static QMutex mutex;
+    static QHash<QPair<QString, uint>, QRegularExpression> cache;
+
+    QPair<QString, uint> key(regexp, categories.Version());
+    QMutexLocker locker(&mutex);
+    auto it = cache.constFind(key);
+    if (it != cache.constEnd()) return it.value();
+
+    if (cache.size() >= 1024) cache.clear();
+    QRegularExpression compiled(PreProcessRegexp(regexp, categories));
+    compiled.optimize();
+    cache.insert(key, compiled);
+    return compiled;
+}
+
+QVector<int> SoundChanges::SyllableEnds(const QRegularExpression &regexp, const QString &word)
+{
+    // Each syllable is matched where the last one ended, so the word is never copied or searched again. An empty
+    // syllable would never advance, so it ends the word just like a failed match.
+    QVector<int> ends;
+    int offset = 0;
+    forever
     {
-        result.append((first ? "" : QString(seperator)) + match.captured());
-        word.remove(_regexp);
-        if (first) first = false;
-        match = _regexp.match(word);
+        QRegularExpressionMatch match = regexp.match(word, offset, QRegularExpression::NormalMatch, QRegularExpression::AnchoredMatchOption);
+        if (!match.hasMatch() || match.capturedLength() == 0) break;
+        offset = match.capturedEnd();
+        ends.append(offset);
     }
+    return ends;
+}
+
+QString SoundChanges::Syllabify(const QRegularExpression &regexp, const QString &word, QChar seperator)
+{
+    QString result;
+    result.reserve(word.length() * 2);
+    int start = 0;
+    for (int end : SyllableEnds(regexp, word))
+    {
+        if (start > 0) result.append(seperator);
+        result.append(word.midRef(start, end - start));
+        start = end;
+    }
+
+    // anything the regexp didn't match is kept as part of the last syllable, so a word it can't split at all (for
+    // instance if it is empty) is left as it is rather than lost
+    result.append(word.midRef(start));
     return result;
 }
 
-QString SoundChanges::RemoveDuplicates(QString s)
+bool SoundChanges::AddForms(OrderedSet<QString> &set, const QString &forms, int limit)
 {
-    QStringList sl;
-    for (QString _s : s.split(' '))
+    auto add = [&set, limit](const QString &form)
     {
-        if (!sl.contains(_s))
-        {
-            sl.append(_s);
-        }
+        if (limit > 0 && set.Count() >= limit && !set.Contains(form)) return false;
+        set.Insert(form);
+        return true;
+    };
+
+    // most forms have no spaces, so they don't need splitting
+    if (!forms.contains(' ')) return forms.isEmpty() || add(forms);
+    bool all = true;
+    for (const QString &form : forms.split(' ', QString::SkipEmptyParts))
+    {
+        if (!add(form)) all = false;
     }
-    return sl.join(' ');
+    return all;
 }
 
-QStringList SoundChanges::Reanalyse(QStringList sl)
+SoundChanges::FilterSet SoundChanges::CompileFilters(const QStringList &filters, const CategoryTable &categories)
 {
-    QStringList result;
-    for (QString s : sl)
+    // backreferences, subroutine calls, recursion and conditions all refer to groups by number or to the whole
+    // pattern, so they would refer to something else once the filters are joined together
+    static const QRegularExpression backreference("\\\\(?:[1-9]|g|k)|\\(\\?(?:P[=>]|[-+]?[0-9]|R|&|\\()");
+
+    // each filter is checked on its own first, as one invalid filter would make the combined regexp invalid
+    FilterSet set;
+    QStringList combined;
+    QVector<QRegularExpression> combinable;
+    for (const QString &filter : filters)
     {
-        for (QString _s : s.split(' ', QString::SkipEmptyParts))
+        QRegularExpression compiled = CompiledRegexp(filter, categories);
+        if (!compiled.isValid()) continue;
+        if (backreference.match(filter).hasMatch()) set.separate.append(compiled);
+        else
         {
-            if (!result.contains(_s)) result.append(_s);
+            combined.append("(?:" + filter + ')');
+            combinable.append(compiled);
         }
     }
-    return result;
+    if (!combined.isEmpty())
+    {
+        // filters which are valid on their own can still fail to combine (for instance if one has an unmatched
+        // '\Q'), in which case they are matched one at a time instead
+        set.combined = CompiledRegexp(combined.join('|'), categories);
+        set.hasCombined = set.combined.isValid();
+        if (!set.hasCombined) set.separate += combinable;
+    }
+    return set;
+}
+
+bool SoundChanges::FilterSet::Matches(const QString &word) const
+{
+    if (hasCombined && combined.match(word).hasMatch()) return true;
+    for (const QRegularExpression &regexp : separate)
+    {
+        if (regexp.match(word).hasMatch()) return true;
+    }
+    return false;
 }
 
-QStringList SoundChanges::Filter(QStringList sl, QStringList f, QMap<QChar, QList<QChar>> cats)
+QStringList SoundChanges::Filter(const QStringList &sl, const FilterSet &filters)
 {
+    if (filters.IsEmpty()) return sl;
+
     QStringList result;
-    for (QString s : sl)
+    for (const QString &s : sl)
     {
-        bool append = false;
-        for (QString regexp : f)
-        {
-            append |= QRegularExpression(SoundChanges::PreProcessRegexp(regexp, cats)).match(s).hasMatch();
-        }
-        if (!append) result.append(s);
+        if (!filters.Matches(s)) result.append(s);
     }
     return result;
 }
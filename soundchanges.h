@@ -1,86 +1,202 @@
 #ifndef SOUNDCHANGES_H
 #define SOUNDCHANGES_H
 
+#include <QString>
+#include <QStringList>
+#include <QList>
+#include <QVector>
+#include <QVarLengthArray>
+#include <QSet>
+#include <QPair>
+#include <QCache>
+#include <QRegularExpression>
+#include <QMutex>
+#include <memory>
+#include <utility>
+#include "matcher.h"
+#include "orderedset.h"
 
-class QString;
-class QStringList;
 class QChar;
-class QRegularExpression;
-template <class Key, class T> class QMap;
-template <class T> class QList;
-template <class T> class QQueue;
-
-namespace std
-{
-    template <class T1, class T2> struct pair;
-}
+class CategoryTable;
 
 class SoundChanges
 {
 public:
-    static QStringList ApplyChange(QString word, QString change, QMap<QChar, QList<QChar>> categories, int probability, bool reverse, bool alwaysApply, bool sometimesApply);
+    // A single line of the sound changes, parsed once so it can be applied to every word without re-parsing
+    struct Rule
+    {
+        QString change;         // the change itself without flags or comments, e.g. 'a/e/C_'
+        QString key;            // the flags and the change, ignoring comments and spacing, so edits can be found
+        bool isValid = false;
+        bool isRegex = false;   // for rules of the form '_regexp/replacement'
+        QString target;         // for regex rules, this is the regexp without the leading '_'
+        QString replacement;
+        QRegularExpression regexp;  // the compiled target of regex rules
+        QString environment;
+        QStringList exceptions;
+        Matcher matcher;        // the environment, target and exceptions compiled together
+        Matcher reverseMatcher; // the same, but matching the replacement instead of the target
+
+        int probability = 100;
+        bool syllabify = false;
+        bool forwardOnly = false;
+        bool backwardOnly = false;
+        bool alwaysApply = false;
+        bool sometimesApply = false;
+    };
+
+    // A FIFO queue of (index, phoneme) pairs recording the categories matched by the target. Small queues are
+    // stored inline, so it doesn't need to allocate in the common case.
+    class CategoryQueue
+    {
+    public:
+        void clear() { m_items.clear(); m_head = 0; }
+        int length() const { return m_items.size() - m_head; }
+        void enqueue(const std::pair<int, QChar> &item) { m_items.append(item); }
+        std::pair<int, QChar> dequeue() { return m_items.at(m_head++); }
+
+    private:
+        QVarLengthArray<std::pair<int, QChar>, 16> m_items;
+        int m_head = 0;
+    };
+
+    // A counter-based random number generator for '?' rules. Streams are derived from the run's seed and the
+    // position of the word, subword, rule and candidate, so the numbers drawn for a word don't depend on which
+    // words were processed before it or on which thread processed them.
+    class RandomStream
+    {
+    public:
+        explicit RandomStream(quint64 seed = 0);
+        RandomStream Substream(quint64 id) const;
+        double Next();          // uniformly distributed in [0, 1)
+
+    private:
+        quint64 m_key;
+        quint64 m_counter;
+    };
+
+    // One of the words produced by applying a rule so far
+    struct Branch
+    {
+        QString word;
+        int index;              // the position in word to try the rule at next
+        int matches;            // the index of the matches for word in Scratch::matches, or -1 if it hasn't been scanned yet
+    };
+
+    // What applying one rule to one form gave, as kept by Scratch::ruleResults
+    struct RuleResult
+    {
+        QString before;         // the form the rule was applied to, after syllabifying it
+        QStringList after;      // the forms it changed to, without duplicates
+        bool truncated;
+    };
+
+    // The temporaries used by ApplyChange. Keeping one of these for a whole run means the containers keep their
+    // capacity from word to word, so applying a rule only allocates for the new words it creates.
+    struct Scratch
+    {
+        QVector<Branch> replaced;
+        QVector<Branch> newReplaced;
+        QSet<QPair<QString, int>> newBranches;  // the (word, index) pairs already in newReplaced
+        QVector<QString> replacements;
+        QVector<QString> newReplacements;
+        CategoryQueue catnums;
+        QVector<Matcher::Matches> matches;
+        Matcher::Workspace workspace;
+        std::unique_ptr<Scratch> forward;       // used for the forward check in reverse mode
+        QVector<QString> results;               // the words ApplyChange changed a word to
+
+        // The results of the forward check in reverse mode, keyed on the rule and the candidate. Once the cache holds
+        // more than its maximum cost (in characters), the least recently used results are dropped.
+        QCache<QPair<const Rule *, QString>, QStringList> forwardResults{1 << 22};
+
+        // The results of applying each rule, keyed on its index and the form it was applied to, so forms which come
+        // up in many words (such as those from the same root) only have each rule applied once. Random rules aren't
+        // kept. The maximum cost is in characters; if it is 0, nothing is kept.
+        QCache<QPair<int, QString>, RuleResult> ruleResults{0};
+
+        OrderedSet<QString> forms;              // the forms of a word after a rule, without duplicates
+        RuleResult ruleResult;                  // the result of the rule being applied, if it isn't in ruleResults
+        QVector<quint64> masks;                 // Matcher::SymbolMask() of each of the forms of a word
+
+        int branchLimit = 0;    // the most words ApplyChange may keep for one word at once, or 0 for no limit
+        bool truncated = false; // set by ApplyChange when it has had to drop words to stay within branchLimit
+    };
+
+    // Scratches kept from one run to the next, so the caches in them carry over from one part of a lexicon to the
+    // next. Each worker takes one for as long as it runs.
+    class ScratchPool
+    {
+    public:
+        ScratchPool() {}
+        ~ScratchPool();
+
+        Scratch *Take();
+        void Return(Scratch *scratch);
+
+    private:
+        Q_DISABLE_COPY(ScratchPool)
+
+        QMutex m_mutex;
+        QList<Scratch *> m_free;
+    };
+
+    static Rule CompileRule(QString line, const CategoryTable &categories);
+
+    static QList<Rule> CompileRules(QStringList lines, const CategoryTable &categories);
 
-    static QString PreProcessRegexp(QString regexp, QMap<QChar,QList<QChar>> categories);
+    // Applies rule to word. Returns false if the only result is word itself, which is by far the most common case,
+    // so nothing needs to be allocated for it; otherwise the results are left in scratch.results.
+    static bool ApplyChange(const QString &word, const Rule &rule, const CategoryTable &categories, bool reverse, Scratch &scratch, RandomStream &random);
 
-    static QString Syllabify(QString regexp, QString word, QChar seperator);
+    // rewrites holds lines of the form 'from>to'; if backwards is set they are applied from right to left. This
+    // compiles them each time, so use a Rewriter to apply the same ones to many strings.
+    static QString ApplyRewrite(QString str, const QStringList &rewrites, bool backwards = false);
 
-    static QString RemoveDuplicates(QString s);
+    static QString PreProcessRegexp(QString regexp, const CategoryTable &categories);
 
-    static QStringList Reanalyse(QStringList sl);
+    // Returns the preprocessed and optimised regexp, compiling it only if it hasn't been seen before with these categories
+    static QRegularExpression CompiledRegexp(const QString &regexp, const CategoryTable &categories);
 
-    static QStringList Filter(QStringList sl, QStringList f, QMap<QChar, QList<QChar>> cats);
+    // Returns where each syllable of word ends. regexp is matched at the start of each syllable in turn, so it
+    // shouldn't start with '^'; anything after the last syllable it matches isn't part of any syllable.
+    static QVector<int> SyllableEnds(const QRegularExpression &regexp, const QString &word);
 
-    static void ReverseFirstTwo(QStringList &l);
+    // Returns the syllables of word with seperator between them. Whatever is left after the last syllable is added
+    // to it without a seperator.
+    static QString Syllabify(const QRegularExpression &regexp, const QString &word, QChar seperator);
+
+    // Adds each space-seperated form in forms to set, unless set already has limit forms (if limit isn't 0). Returns
+    // false if any had to be left out.
+    static bool AddForms(OrderedSet<QString> &set, const QString &forms, int limit = 0);
+
+    // Filters compiled into one regexp, so each form is only matched once however many filters there are
+    struct FilterSet
+    {
+        QRegularExpression combined;
+        bool hasCombined = false;
+        QVector<QRegularExpression> separate;   // filters which refer to groups or recurse, which would change if they were combined,
+                                                // and the rest as well if combining them didn't give a valid regexp
+
+        bool IsEmpty() const { return !hasCombined && separate.isEmpty(); }
+        bool Matches(const QString &word) const;
+    };
+
+    static FilterSet CompileFilters(const QStringList &filters, const CategoryTable &categories);
+
+    // Removes the forms matching any of the filters
+    static QStringList Filter(const QStringList &sl, const FilterSet &filters);
 
 private:
-    static bool TryRule(QString word,
-                        int wordIndex,
-                        QString change,
-                        QMap<QChar, QList<QChar>> categories,
-                        int *startpos,
-                        int *length,
-                        QQueue<std::pair<int, QChar>> *catnums,
-                        bool reverse);
-
-    static bool TryCharacters(QString word,
-                              int wordIndex,
-                              int *finalIndex,
-                              QString change,
-                              QString target,
-                              QMap<QChar, QList<QChar>> categories,
-                              int *startpos,
-                              int *length,
-                              QQueue<std::pair<int, QChar>> *outcats,
-                              bool recordcats,
-                              QChar *lastCharParsed);
-
-    static bool TryCharacter(QString word,
-                             QChar c,
-                             QChar lastChar,
-                             QChar *lastCharParsed,
-                             QString target,
-                             int &curIndex,
-                             QMap<QChar, QList<QChar>> categories,
-                             int *startpos,
-                             int *length,
-                             QQueue<std::pair<int, QChar>> *outcats,
-                             bool recordcats);
-
-    static bool MatchChar(QChar char1,
-                          QChar char2,
-                          QMap<QChar, QList<QChar>> categories,
-                          int *catnum);
-
-    static std::pair<QString, bool> ParseNonce(QList<QChar> nonce, QMap<QChar, QList<QChar>> categories);
-
-    static int ActualLength(QString rule);
-
-    static int MaxLength(QList<std::pair<QString, int>> l);
+    static bool ApplyChange(const QString &word, const Rule &rule, const CategoryTable &categories, int probability, bool reverse, bool alwaysApply, bool sometimesApply, Scratch &scratch, RandomStream &random);
+
+    static void AddBranch(Scratch &scratch, const Branch &branch);
+
+    static int MaxLength(const QVector<Branch> &l);
 
     enum class State
     {
         Normal,
-        Optional,
         Nonce,
         Backreference
     };
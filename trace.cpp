@@ -0,0 +1,101 @@
+#include <QString>
+#include <QVector>
+#include <QHash>
+#include <cstring>
+#include <QIODevice>
+#include <QDataStream>
+#include <QTextStream>
+#include "trace.h"
+
+void Trace::Append(int word, const QVector<Change> &changes)
+{
+    for (const Change &change : changes)
+    {
+        Entry entry;
+        entry.rule = Intern(change.rule);
+        entry.word = quint32(word);
+        entry.before = Intern(change.before);
+        entry.after = Intern(change.after);
+        m_entries.append(entry);
+    }
+}
+
+QString Trace::String(quint32 id) const
+{
+    return QString(m_text.data() + m_starts.at(id), int(m_starts.at(id + 1) - m_starts.at(id)));
+}
+
+QString Trace::Format(int i) const
+{
+    const Entry &entry = m_entries.at(i);
+    return QString("%1: %2 changed %3 to %4").arg(entry.word + 1).arg(String(entry.rule), String(entry.before), String(entry.after));
+}
+
+bool Trace::WriteTsv(QIODevice *device) const
+{
+    QTextStream out(device);
+    out.setCodec("UTF-8");
+    for (const Entry &entry : m_entries)
+    {
+        out << entry.word + 1 << '\t' << String(entry.rule) << '\t' << String(entry.before) << '\t' << String(entry.after) << '\n';
+    }
+    out.flush();
+    return out.status() == QTextStream::Ok;
+}
+
+bool Trace::WriteBinary(QIODevice *device) const
+{
+    QDataStream out(device);
+    out.writeRawData("exSCAtrc", 8);
+    out << quint32(1);                      // the version of the format
+
+    out << quint32(m_starts.length() > 0 ? m_starts.length() - 1 : 0);
+    for (int id = 0; id + 1 < m_starts.length(); id++) out << String(quint32(id));
+
+    out << quint32(m_entries.length());
+    for (const Entry &entry : m_entries) out << entry.rule << entry.word << entry.before << entry.after;
+    return out.status() == QDataStream::Ok;
+}
+
+// The strings are only stored in m_text, and the table refers to them by id, so the text isn't kept twice
+quint32 Trace::Intern(const QString &s)
+{
+    uint hash = qHashBits(s.constData(), size_t(s.length()) * sizeof(QChar));
+    if ((m_hashes.length() + 1) * 2 > m_slots.length()) Grow();
+
+    int mask = m_slots.length() - 1;
+    int slot = int(hash) & mask;
+    for (; m_slots.at(slot) != 0; slot = (slot + 1) & mask)
+    {
+        quint32 id = m_slots.at(slot) - 1;
+        if (m_hashes.at(int(id)) == hash && Equals(id, s)) return id;
+    }
+
+    if (m_starts.isEmpty()) m_starts.append(0);
+    quint32 id = quint32(m_hashes.length());
+    m_text.insert(m_text.end(), s.constData(), s.constData() + s.length());
+    m_starts.append(qint64(m_text.size()));
+    m_hashes.append(hash);
+    m_slots[slot] = id + 1;
+    return id;
+}
+
+bool Trace::Equals(quint32 id, const QString &s) const
+{
+    qint64 start = m_starts.at(int(id));
+    return m_starts.at(int(id) + 1) - start == s.length()
+        && std::memcmp(m_text.data() + start, s.constData(), size_t(s.length()) * sizeof(QChar)) == 0;
+}
+
+// Doubles the size of the table and puts every id back into it
+void Trace::Grow()
+{
+    m_slots.fill(0, qMax(64, m_slots.length() * 2));
+    int mask = m_slots.length() - 1;
+    for (int id = 0; id < m_hashes.length(); id++)
+    {
+        int slot = int(m_hashes.at(id)) & mask;
+        while (m_slots.at(slot) != 0) slot = (slot + 1) & mask;
+        m_slots[slot] = quint32(id) + 1;
+    }
+}
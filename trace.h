@@ -0,0 +1,59 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QString>
+#include <QVector>
+#include <vector>
+
+class QIODevice;
+
+// A compact record of which rules changed which words, for 'Report which rules apply'. Every rule and word form is
+// stored once, and each change is four integers, so recording a whole run costs little more than the run itself.
+class Trace
+{
+public:
+    // One change, as recorded by the engine for a single word. The strings are implicitly shared with the engine's
+    // own copies, so recording one doesn't copy any text.
+    struct Change
+    {
+        QString rule;
+        QString before;
+        QString after;
+    };
+
+    struct Entry
+    {
+        quint32 rule;           // the id of the rule's text
+        quint32 word;           // the line number of the word in the lexicon
+        quint32 before;         // the id of the word before the change
+        quint32 after;          // the id of the word after the change
+    };
+
+    void Append(int word, const QVector<Change> &changes);
+
+    int Count() const { return m_entries.length(); }
+    const Entry &At(int i) const { return m_entries.at(i); }
+    QString String(quint32 id) const;
+
+    // Formats an entry as plain text for the report
+    QString Format(int i) const;
+
+    // Writes one line per entry: word number, rule, before and after, seperated by tabs
+    bool WriteTsv(QIODevice *device) const;
+
+    // Writes the string table followed by the entries, using QDataStream
+    bool WriteBinary(QIODevice *device) const;
+
+private:
+    std::vector<QChar> m_text;              // every string, one after the other; this can be larger than a QString
+    QVector<qint64> m_starts;               // where each string starts in m_text, plus the end of the last one
+    QVector<uint> m_hashes;                 // the hash of each string
+    QVector<quint32> m_slots;               // an open-addressed hash table of ids plus one, or 0 for an empty slot
+    QVector<Entry> m_entries;
+
+    quint32 Intern(const QString &s);
+    bool Equals(quint32 id, const QString &s) const;
+    void Grow();
+};
+
+#endif // TRACE_H
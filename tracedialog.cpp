@@ -0,0 +1,124 @@
+#include <QDialog>
+#include <QAbstractListModel>
+#include <QVBoxLayout>
+#include <QHBoxLayout>
+#include <QLineEdit>
+#include <QListView>
+#include <QLabel>
+#include <QPushButton>
+#include <QFileDialog>
+#include <QMessageBox>
+#include <QFile>
+#include <QVector>
+#include <QHash>
+#include "tracedialog.h"
+#include "trace.h"
+
+TraceModel::TraceModel(QSharedPointer<const Trace> trace, QObject *parent) : QAbstractListModel(parent), m_trace(trace)
+{
+}
+
+int TraceModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid()) return 0;
+    return m_searching ? m_rows.length() : m_trace->Count();
+}
+
+QVariant TraceModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || role != Qt::DisplayRole) return QVariant();
+    return m_trace->Format(m_searching ? m_rows.at(index.row()) : index.row());
+}
+
+void TraceModel::SetSearch(const QString &search)
+{
+    beginResetModel();
+    m_searching = !search.isEmpty();
+    m_rows.clear();
+    if (m_searching)
+    {
+        // every string is only stored once, so it is quicker to find the strings which match first
+        QHash<quint32, bool> matches;
+        auto matchesSearch = [&](quint32 id)
+        {
+            auto it = matches.constFind(id);
+            if (it != matches.constEnd()) return it.value();
+            bool match = m_trace->String(id).contains(search);
+            matches.insert(id, match);
+            return match;
+        };
+
+        for (int i = 0; i < m_trace->Count(); i++)
+        {
+            const Trace::Entry &entry = m_trace->At(i);
+            if (matchesSearch(entry.rule) || matchesSearch(entry.before) || matchesSearch(entry.after)) m_rows.append(i);
+        }
+    }
+    endResetModel();
+}
+
+TraceDialog::TraceDialog(QSharedPointer<const Trace> trace, QWidget *parent) : QDialog(parent), m_trace(trace)
+{
+    setWindowTitle("Rules applied");
+
+    m_layout = new QVBoxLayout;
+    m_bottomlayout = new QHBoxLayout;
+    setLayout(m_layout);
+
+    m_search = new QLineEdit;
+    m_search->setPlaceholderText("Search");
+    m_layout->addWidget(m_search);
+
+    m_model = new TraceModel(trace, this);
+    m_entries = new QListView;
+    m_entries->setModel(m_model);
+    m_entries->setUniformItemSizes(true);
+    m_layout->addWidget(m_entries);
+
+    m_count = new QLabel;
+    m_bottomlayout->addWidget(m_count);
+    m_bottomlayout->addStretch();
+
+    m_exportTsv = new QPushButton("Export as TSV");
+    m_bottomlayout->addWidget(m_exportTsv);
+    m_exportBinary = new QPushButton("Export as binary");
+    m_bottomlayout->addWidget(m_exportBinary);
+    m_layout->addLayout(m_bottomlayout);
+
+    connect(m_search, &QLineEdit::textChanged, this, &TraceDialog::Search);
+    connect(m_exportTsv, &QPushButton::clicked, this, &TraceDialog::ExportTsv);
+    connect(m_exportBinary, &QPushButton::clicked, this, &TraceDialog::ExportBinary);
+
+    Search(QString());
+    resize(600, 400);
+}
+
+void TraceDialog::Search(const QString &search)
+{
+    m_model->SetSearch(search);
+    m_count->setText(QString("%1 of %2 changes").arg(m_model->rowCount()).arg(m_trace->Count()));
+}
+
+void TraceDialog::ExportTsv()
+{
+    QString fileName = QFileDialog::getSaveFileName(this, "Export Report", QString(), "Tab-seperated values (*.tsv);;All files (*.*)");
+    if (fileName.isEmpty()) return;
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly) || !m_trace->WriteTsv(&file))
+    {
+        QMessageBox::warning(this, "Could Not Save File", "The file could not be saved");
+    }
+}
+
+void TraceDialog::ExportBinary()
+{
+    QString fileName = QFileDialog::getSaveFileName(this, "Export Report", QString(), "exSCA trace files (*.trc);;All files (*.*)");
+    if (fileName.isEmpty()) return;
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly) || !m_trace->WriteBinary(&file))
+    {
+        QMessageBox::warning(this, "Could Not Save File", "The file could not be saved");
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef TRACEDIALOG_H
+#define TRACEDIALOG_H
+
+#include <QDialog>
+#include <QAbstractListModel>
+#include <QSharedPointer>
+#include <QVector>
+#include "trace.h"
+
+class QVBoxLayout;
+class QHBoxLayout;
+class QLineEdit;
+class QListView;
+class QLabel;
+class QPushButton;
+
+// Shows the entries of a Trace which involve a search string. Entries are only formatted when they are shown.
+class TraceModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+public:
+    TraceModel(QSharedPointer<const Trace> trace, QObject *parent = 0);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+
+    // Only shows the entries whose rule or words contain search, or every entry if it is empty
+    void SetSearch(const QString &search);
+
+private:
+    QSharedPointer<const Trace> m_trace;
+    QVector<int> m_rows;                // the entries shown, if there is a search
+    bool m_searching = false;
+};
+
+class TraceDialog : public QDialog
+{
+    Q_OBJECT
+
+public:
+    explicit TraceDialog(QSharedPointer<const Trace> trace, QWidget *parent = 0);
+
+private slots:
+    void Search(const QString &search);
+    void ExportTsv();
+    void ExportBinary();
+
+private:
+    QSharedPointer<const Trace> m_trace;
+    TraceModel *m_model;
+
+    QVBoxLayout *m_layout;
+    QHBoxLayout *m_bottomlayout;
+    QLineEdit *m_search;
+    QListView *m_entries;
+    QLabel *m_count;
+    QPushButton *m_exportTsv;
+    QPushButton *m_exportBinary;
+};
+
+#endif // TRACEDIALOG_H
@@ -1,9 +1,19 @@
 #include <QtCore>
 #include <QtWidgets>
 #include <random>
+#include <algorithm>
 
 #include "window.h"
 #include "soundchanges.h"
+#include "categorytable.h"
+#include "engine.h"
+#include "enginethread.h"
+#include "lexiconfile.h"
+#include "phonemeinventory.h"
+#include "rewriter.h"
+#include "checkpoints.h"
+#include "resultmodel.h"
+#include "tracedialog.h"
 #include "highlighter.h"
 #include "affixerdialog.h"
 
@@ -19,6 +29,8 @@ Window::Window()
     m_midlayout = new QVBoxLayout;
     m_resultslayout = new QVBoxLayout;
     m_syllableseperatorlayout = new QHBoxLayout;
+    m_seedlayout = new QHBoxLayout;
+    m_branchlimitlayout = new QHBoxLayout;
     mainwidget->setLayout(m_layout);
 
     QFont font("Courier", 10);
@@ -34,6 +46,7 @@ Window::Window()
     m_leftlayout->addWidget(m_rewriteslabel);
     m_rewrites = new QPlainTextEdit;
     m_leftlayout->addWidget(m_rewrites, 1);
+    connect(m_rewrites, &QPlainTextEdit::textChanged, this, &Window::UpdateRewrites);
 
     m_layout->addLayout(m_leftlayout);
 
@@ -57,6 +70,9 @@ Window::Window()
     m_midlayout->addWidget(m_applyfillerlabel);
     m_apply = new QPushButton("Apply");
     m_midlayout->addWidget(m_apply);
+    m_cancel = new QPushButton("Cancel");
+    m_cancel->setEnabled(false);
+    m_midlayout->addWidget(m_cancel);
 
     m_showChangedWords = new QCheckBox("Show changed words");
     m_showChangedWords->setChecked(true);
@@ -122,21 +138,63 @@ Window::Window()
     m_syllableseperatorlayout->setSpacing(0);
 
     m_midlayout->addLayout(m_syllableseperatorlayout);
+
+    m_seedlabel = new QLabel("Random seed: ");
+    m_seedlayout->addWidget(m_seedlabel);
+
+    // if this is left empty a new seed is chosen for every run
+    m_seed = new QLineEdit;
+    m_seed->setPlaceholderText("random");
+    m_seed->setValidator(new QRegularExpressionValidator(QRegularExpression(R"(\d{0,19})"), m_seed));
+    m_seedlayout->addWidget(m_seed);
+
+    m_midlayout->addLayout(m_seedlayout);
+
+    m_branchlimitlabel = new QLabel("Most forms per word: ");
+    m_branchlimitlayout->addWidget(m_branchlimitlabel);
+
+    // stops 's' rules and reversed changes from producing so many forms that they run out of memory
+    m_branchlimit = new QSpinBox;
+    m_branchlimit->setRange(0, 10000000);
+    m_branchlimit->setValue(10000);
+    m_branchlimit->setSpecialValueText("no limit");
+    m_branchlimitlayout->addWidget(m_branchlimit);
+
+    m_midlayout->addLayout(m_branchlimitlayout);
     m_layout->addLayout(m_midlayout);
 
     m_resultslabel = new QLabel("Output lexicon:");
     m_resultslayout->addWidget(m_resultslabel);
-    m_results = new QTextEdit;
-    m_results->setReadOnly(true);
+    m_checkpoints.reset(new Checkpoints);
+    // the output is shown through a model, so only the lines which are visible are ever formatted
+    m_resultmodel = new ResultModel(this);
+    m_results = new QListView;
+    m_results->setModel(m_resultmodel);
+    m_results->setItemDelegate(new ResultDelegate(m_results));
+    m_results->setUniformItemSizes(true);
+    m_results->setSelectionMode(QAbstractItemView::ExtendedSelection);
     m_resultslayout->addWidget(m_results);
 
+    QAction *copyAction = new QAction("Copy", m_results);
+    copyAction->setShortcut(QKeySequence::Copy);
+    copyAction->setShortcutContext(Qt::WidgetShortcut);
+    m_results->addAction(copyAction);
+    m_results->setContextMenuPolicy(Qt::ActionsContextMenu);
+    connect(copyAction, &QAction::triggered, this, &Window::CopyResults);
+
     m_layout->addLayout(m_resultslayout);
 
     m_categorieslist = new QMap<QChar, QList<QChar>>();
 
     connect(m_categories, &QPlainTextEdit::textChanged, this, &Window::UpdateCategories);
     connect(m_apply, &QPushButton::clicked, this, &Window::DoSoundChanges);
+    connect(m_cancel, &QPushButton::clicked, this, &Window::CancelSoundChanges);
     connect(m_filtercurrent, &QPushButton::clicked, this, &Window::FilterCurrent);
+    connect(m_showChangedWords, &QCheckBox::toggled, this, &Window::UpdateFormat);
+    for (QRadioButton *format : { m_plainformat, m_arrowformat, m_squareinputformat, m_squareglossformat, m_arrowglossformat })
+    {
+        connect(format, &QRadioButton::toggled, this, &Window::UpdateFormat);
+    }
 
     fileMenu = menuBar()->addMenu("File");
     fileMenu->addAction("Open sound changes", this, &Window::OpenEsc, QKeySequence(QKeySequence::Open));
@@ -158,162 +216,170 @@ Window::Window()
     }
 }
 
+Window::~Window()
+{
+    // runs which are still going have to stop before their threads are destroyed
+    for (EngineThread *run : findChildren<EngineThread *>())
+    {
+        run->Cancel();
+        run->wait();
+    }
+}
+
 void Window::DoSoundChanges()
 {
-    bool reverse = m_reversechanges->isChecked();
-    QStringList changes = ApplyRewrite(m_rules->toPlainText()).split('\n', QString::SkipEmptyParts);
-    if (reverse) std::reverse(changes.begin(), changes.end());
+    Engine::Settings settings;
+    settings.rules = m_rules->toPlainText();
+    settings.rewrites = m_rewrites->toPlainText().split('\n', QString::SkipEmptyParts);
+    PhonemeInventory phonemes = CurrentPhonemes();
+    settings.phonemes = phonemes.Phonemes();
+    settings.phonemeIds = phonemes.Ids();
+    settings.categories = Engine::ParseCategories(phonemes.Tokenize(m_validCategories).split('\n', QString::SkipEmptyParts));
+    settings.filters = m_filters->toPlainText().split('\n', QString::SkipEmptyParts);
+    settings.syllabify = m_syllabify->text();
+    settings.syllableSeperator = m_syllableseperator->text().isEmpty() ? QChar('-') : m_syllableseperator->text().at(0);
+    settings.reverse = m_reversechanges->isChecked();
+    settings.rewriteOnOutput = m_doBackwards->isChecked();
+    settings.reportChanges = m_reportChanges->isChecked();
+    settings.branchLimit = m_branchlimit->value();
+
+    bool seedOk;
+    settings.seed = m_seed->text().toULongLong(&seedOk);
+    if (!seedOk)
+    {
+        std::random_device rd;
+        settings.seed = (quint64(rd()) << 32) | rd();
+    }
+
+    // a new run replaces any run which is still going
+    if (m_run)
+    {
+        disconnect(m_run, 0, this, 0);
+        disconnect(m_run, 0, m_progress, 0);
+        m_run->Cancel();
+    }
 
-    m_progress->setMaximum(qMax(1, changes.length()));    // we use qMax to avoid showing a busy indicator when no changes are specified
+    QStringList words;
+    if (!m_lexicon) words = m_words->toPlainText().split('\n');
+    int wordCount = m_lexicon ? m_lexicon->Count() : words.length();
+
+    // a mapped lexicon can't change while it is open, so it is identified by its file instead of its contents; the
+    // words in the text box are identified by a SHA-256 digest rather than by keeping a copy of them
+    if (m_lexicon) settings.lexiconKey = QString("%1\n%2\n%3").arg(m_lexicon->FileName()).arg(m_lexicon->Size()).arg(QFileInfo(m_lexicon->FileName()).lastModified().toMSecsSinceEpoch()).toUtf8();
+    else           settings.lexiconKey = QCryptographicHash::hash(words.join('\n').toUtf8(), QCryptographicHash::Sha256);
+    m_progress->setMaximum(qMax(1, wordCount));           // we use qMax to avoid showing a busy indicator when there are no words
     m_progress->setMinimum(0);
     m_progress->setValue(0);
+    m_resultmodel->Clear();
+    if (settings.reportChanges) m_trace.reset(new Trace);
+    else                        m_trace.clear();
+    m_truncatedWords.clear();
+    m_branchLimitUsed = settings.branchLimit;
+    m_cancel->setEnabled(true);
+
+    if (m_lexicon) m_run = new EngineThread(settings, m_lexicon, this);
+    else           m_run = new EngineThread(settings, words, this);
+    m_run->SetCheckpoints(m_checkpoints);
+    connect(m_run, &EngineThread::progress, m_progress, &QProgressBar::setValue);
+    connect(m_run, &EngineThread::output, this, &Window::ShowResults);
+    connect(m_run, &EngineThread::finishedRun, this, &Window::FinishSoundChanges);
+    connect(m_run, &QThread::finished, m_run, &QObject::deleteLater);
+    m_run->start();
+}
 
-    QStringList result;
-    QString syllabifyregexp(SoundChanges::PreProcessRegexp(m_syllabify->text(), *m_categorieslist));
-    QString report;
-    for (QString word : m_words->toPlainText().split('\n'))
-    {
-        QString gloss = "";
-        bool hasGloss = false;
+void Window::CancelSoundChanges()
+{
+    if (m_run) m_run->Cancel();
+}
 
-        if (word.split('>').length() > 1)
+void Window::ShowResults(int first, QVector<Engine::Result> results)
+{
+    // results always arrive in order, so they can just be added to the end
+    for (int i = 0; i < results.length(); i++)
+    {
+        const Engine::Result &word = results.at(i);
+        if (m_trace) m_trace->Append(first + i, word.changes);
+        for (const QString &truncated : word.truncated)
         {
-            hasGloss = true;
-            QStringList split = word.split('>');
-            gloss = split.at(1);
-            word = split.at(0);
+            if (!m_truncatedWords.contains(truncated)) m_truncatedWords.append(truncated);
         }
+    }
+    m_resultmodel->Append(results);
+}
 
-        QString changed = "";
-        for (QString subword : word.split(' ', QString::SkipEmptyParts))
-        {
-            QStringList subchanged = ApplyRewrite(subword).split(' ', QString::SkipEmptyParts);
-
-            for (QString change : changes)
-            {
-                bool alwaysApply = false;
-                bool sometimesApply = false;
-                bool reverseThisWord = reverse;
-                for (QString &_subchanged : subchanged)
-                {
-                    QStringList splitchange;
-                    if ((change.at(0) == QChar('_')) || QRegularExpression(" _").match(change).hasMatch())
-                        // We need the second expression to account for cases like 'f _ax*b/c'
-                        splitchange = change                                           .split(' ', QString::SkipEmptyParts);
-                    else
-                        splitchange = change.replace(QRegularExpression(R"(\*.*)"), "").split(' ', QString::SkipEmptyParts);
-
-                    if (splitchange.length() == 0) continue;
-                    QString _change;
-                    int prob = 100;
-                    if (splitchange.length() > 1)
-                    {
-                        _change = splitchange.at(splitchange.length() - 1);
-                        for (int i = 0; i < splitchange.length() - 1; i++)
-                        {
-                            switch (splitchange.at(i).at(0).toLatin1())
-                            {
-                            case 'x':
-                                _subchanged = SoundChanges::Syllabify(syllabifyregexp, _subchanged, m_syllableseperator->text().at(0));
-                                break;
-                            case '?':
-                            {
-                                bool ok;
-                                int _prob = QString(splitchange.at(i).mid(1)).toInt(&ok);
-                                if (ok)
-                                {
-                                    prob = _prob;
-                                }
-                                break;
-                            }
-                            case 'f':
-                                if (reverseThisWord)
-                                    goto CONTINUE;
-                                break;
-                            case 'b':
-                                if (!reverseThisWord)
-                                    goto CONTINUE;
-                                reverseThisWord = false;      // So we can use normal rules with no special handling
-                                break;
-                            case 'a':
-                                alwaysApply = true;
-                                break;
-                            case 's':
-                                sometimesApply = true;
-                                break;
-                            }
-                        }
-                    }
-                    else _change = splitchange.at(0);
-
-                    // Block is so no compiler error occurs: "Initialization of 'before' is skipped by 'goto CONTINUE'
-                    {
-                        QString before = _subchanged;
-                        _subchanged = SoundChanges::RemoveDuplicates(SoundChanges::ApplyChange(_subchanged, _change, *m_categorieslist, prob, reverseThisWord, alwaysApply, sometimesApply).join(' '));
-                        _subchanged.remove(m_syllableseperator->text().at(0));
-                        if (_subchanged != before)
-                            report.append(QString("<b>%1</b> changed <b>%2</b> to <b>%3</b><br/>").arg(_change, before, _subchanged));
-                    }
-                CONTINUE:;
-                }
-                subchanged = SoundChanges::Reanalyse(subchanged);
-                m_progress->setValue(m_progress->value() + 1);
-            }
-            m_progress->setValue(0);
-
-            QString subchangedJoined = SoundChanges::Filter(subchanged, m_filters->toPlainText().split('\n', QString::SkipEmptyParts), *m_categorieslist).join(' ');
-            if (m_doBackwards->isChecked()) subchangedJoined = ApplyRewrite(subchangedJoined, true);
-            if (m_showChangedWords->isChecked() && subchangedJoined != subword) subchangedJoined = QString("<b>").append(subchangedJoined).append("</b>");
-
-            if (changed.length() == 0) changed =        subchangedJoined;
-            else                       changed += ' ' + subchangedJoined;
-        }
-        changed = FormatOutput(word.trimmed(), changed.trimmed(), gloss.trimmed(), hasGloss);
-        result.append(changed);
+void Window::FinishSoundChanges(bool cancelled)
+{
+    m_run = nullptr;
+    m_cancel->setEnabled(false);
+    m_progress->setValue(0);
+    if (cancelled) return;
+
+    if (m_truncatedWords.length() > 0)
+    {
+        QMessageBox::warning(this, "Output Truncated",
+                             QString("%1 word(s) had more than %2 possible forms, so only the first %2 were kept:<br/><b>%3</b>")
+                                 .arg(m_truncatedWords.length())
+                                 .arg(m_branchLimitUsed)
+                                 .arg(m_truncatedWords.mid(0, 20).join(' ')));
     }
-    m_results->setHtml(result.join("<br/>"));
 
-    if (m_reportChanges->isChecked())
+    if (m_trace)
     {
-        QMessageBox *msgBox = new QMessageBox(this);
-        msgBox->setAttribute(Qt::WA_DeleteOnClose);
-        msgBox->setText(report);
-        msgBox->setWindowModality(Qt::NonModal);
-        msgBox->setTextInteractionFlags(Qt::TextSelectableByMouse | Qt::TextSelectableByKeyboard);
-        msgBox->show();
+        TraceDialog *dialog = new TraceDialog(m_trace, this);
+        dialog->setAttribute(Qt::WA_DeleteOnClose);
+        dialog->show();
     }
 }
 
 void Window::FilterCurrent()
 {
-    QList<QString> result;
-    for (QString word : m_results->toPlainText().split('\n'))
-    {
-        result.append(SoundChanges::Filter(word.split(' ', QString::SkipEmptyParts), m_filters->toPlainText().split('\n', QString::SkipEmptyParts), *m_categorieslist).join(' '));
-    }
-    m_results->setHtml(result.join("<br/>"));
+    PhonemeInventory phonemes = CurrentPhonemes();
+    CategoryTable categories(Engine::ParseCategories(phonemes.Tokenize(m_validCategories).split('\n', QString::SkipEmptyParts)));
+    m_resultmodel->Filter(m_filters->toPlainText().split('\n', QString::SkipEmptyParts), categories, phonemes);
+}
+
+// Reformats the output from the stored results, so the sound changes don't need to be applied again
+void Window::UpdateFormat()
+{
+    m_resultmodel->SetFormat(CurrentFormat(), m_showChangedWords->isChecked());
+}
+
+// The phonemes in the categories and rules. Their IDs are chosen so they don't clash with any character which is
+// already used, which would otherwise be turned into a phoneme in the output.
+PhonemeInventory Window::CurrentPhonemes()
+{
+    QString rules = ApplyRewrite(m_rules->toPlainText());
+    QStringList phonemes = PhonemeInventory::Find(m_validCategories, rules);
+
+    QStringList texts{m_validCategories, rules, m_rules->toPlainText(), m_rewrites->toPlainText(), m_filters->toPlainText(), m_syllabify->text()};
+    texts.append(m_lexicon ? m_lexicon->HighCharacters() : m_words->toPlainText());
+    return PhonemeInventory(phonemes, PhonemeInventory::ChooseIds(phonemes.length(), texts));
+}
+
+void Window::CopyResults()
+{
+    QModelIndexList selected = m_results->selectionModel()->selectedRows();
+    std::sort(selected.begin(), selected.end());
+
+    QStringList lines;
+    for (const QModelIndex &index : selected) lines.append(index.data().toString());
+    QApplication::clipboard()->setText(lines.join('\n'));
 }
 
 void Window::UpdateCategories()
 {
-    bool first = true;
-    for (QString line : ApplyRewrite(m_categories->toPlainText()).split('\n', QString::SkipEmptyParts))
+    // the categories are only replaced once at least one of them is valid
+    QString text = ApplyRewrite(m_categories->toPlainText());
+    PhonemeInventory phonemes(PhonemeInventory::Find(text, QString()));
+    QMap<QChar, QList<QChar>> categories = Engine::ParseCategories(phonemes.Tokenize(text).split('\n', QString::SkipEmptyParts));
+    if (!categories.isEmpty())
     {
-        if (!QRegularExpression("^.=.+$").match(line).hasMatch()) continue;
-        QStringList parts = line.split("=");
-
-        if (first) { m_categorieslist = new QMap<QChar, QList<QChar>>; first = false; }
-        QList<QChar> phonemes;
-        for (QChar c : parts.at(1))
-        {
-            if (m_categorieslist->contains(c)) phonemes.append(m_categorieslist->value(c));
-            else phonemes.append(c);
-        }
-        m_categorieslist->insert(parts.at(0).at(0), phonemes);
+        *m_categorieslist = categories;
+        m_validCategories = text;
     }
 
     QString regexp("");
-    first = true;
+    bool first = true;
     for (QChar key : m_categorieslist->keys())
     {
         if (!first) regexp.append("|");
@@ -324,47 +390,27 @@ void Window::UpdateCategories()
     m_highlighter->rehighlight();
 }
 
+// The rewrites are only compiled when they are edited, rather than every time they are used
+void Window::UpdateRewrites()
+{
+    QStringList rewrites = m_rewrites->toPlainText().split('\n', QString::SkipEmptyParts);
+    m_rewriter = Rewriter(rewrites);
+    m_rewriterBackwards = Rewriter(rewrites, true);
+    UpdateCategories();     // the categories are rewritten too
+}
+
 QString Window::ApplyRewrite(QString str, bool backwards)
 {
-    QString rewritten = str;
-    QString s = m_rewrites->toPlainText();
-    for (QString line : m_rewrites->toPlainText().split('\n', QString::SkipEmptyParts))
-    {
-        QStringList parts = line.split('>');
-        if (parts.length() != 2) continue;
-        if (backwards) rewritten.replace(parts.at(1), parts.at(0));
-        else           rewritten.replace(parts.at(0), parts.at(1));
-    }
-    return rewritten;
+    return backwards ? m_rewriterBackwards.Apply(str) : m_rewriter.Apply(str);
 }
 
-QString Window::FormatOutput(QString in, QString out, QString gloss, bool hasGloss)
+Engine::Format Window::CurrentFormat()
 {
-    const QChar arrow(0x2192);
-    if (m_plainformat->isChecked())
-    {
-        if (hasGloss) return QString("%1 > %2").arg(out, gloss);
-        else         return out;
-    }
-    else if (m_arrowformat->isChecked())
-    {
-        return QString("%1 %2 %3").arg(in, arrow, out);
-    }
-    else if (m_squareinputformat->isChecked())
-    {
-        return QString("%1 [%2]").arg(out, in);
-    }
-    else if (m_squareglossformat->isChecked())
-    {
-        if (hasGloss) return QString("%1 [%2]").arg(out, gloss);
-        else         return out;
-    }
-    else if (m_arrowglossformat->isChecked())
-    {
-        if (hasGloss) return QString("%1 %2 %3 [%4]").arg(in, arrow, out, gloss);
-        else         return QString("%1 %2 %3").arg(in, arrow, out);
-    }
-    return out;
+    if      (m_arrowformat->isChecked())       return Engine::Format::Arrow;
+    else if (m_squareinputformat->isChecked()) return Engine::Format::SquareInput;
+    else if (m_squareglossformat->isChecked()) return Engine::Format::SquareGloss;
+    else if (m_arrowglossformat->isChecked())  return Engine::Format::ArrowGloss;
+    return Engine::Format::Plain;
 }
 
 void Window::LaunchAffixer()
@@ -372,10 +418,12 @@ void Window::LaunchAffixer()
     AffixerDialog *affixer = new AffixerDialog;
     affixer->show();
     connect(affixer, &AffixerDialog::addText, this, &Window::AddFromAffixer);
+    connect(affixer, &AffixerDialog::wordListSaved, this, &Window::RealOpenLex);
 }
 
 void Window::AddFromAffixer(QStringList words, AffixerDialog::PlaceToAdd placeToAdd)
 {
+    UseLexiconText();
     QString textToAdd = words.join('\n');
     switch (placeToAdd)
     {
@@ -414,14 +462,7 @@ void Window::RealOpenEsc(QString fileName)
     in.setCodec("UTF-8");
 
     QStringList cats, rules, rews;
-
-    while (!in.atEnd())
-    {
-        QString line = in.readLine();
-        if (line.contains('=')) cats.append(line);
-        else if (line.contains('>') && !line.contains('/')) rews.append(line);
-        else rules.append(line);
-    }
+    Engine::SplitEsc(in, cats, rews, rules);
 
     m_categories->setPlainText(cats.join('\n'));
     m_rules->setPlainText(rules.join('\n'));
@@ -434,24 +475,47 @@ void Window::RealOpenEsc(QString fileName)
 
 void Window::OpenLex()
 {
-    QString fileName = QFileDialog::getOpenFileName(this, "Open .lex File", QString(), "exSCA word files (*.lex);;All files (*.*)");
-    QFile file(fileName);
+    RealOpenLex(QFileDialog::getOpenFileName(this, "Open .lex File", QString(), "exSCA word files (*.lex);;All files (*.*)"));
+}
 
-    if (!file.open(QIODevice::ReadOnly))
+void Window::RealOpenLex(QString fileName)
+{
+    QSharedPointer<LexiconFile> lexicon(new LexiconFile);
+
+    if (!lexicon->Open(fileName))
     {
         QMessageBox::warning(this, "Could Not Open File", "The file could not be opened");
         return;
     }
 
-    QTextStream in(&file);
-    in.setCodec("UTF-8");
+    // Big lexicons are read straight from the file when applying the changes, as the text box would need several
+    // copies of them
+    const qint64 largeLexiconSize = 16 * 1024 * 1024;
+    if (lexicon->Size() > largeLexiconSize)
+    {
+        m_lexicon = lexicon;
+        m_words->clear();
+        m_words->setReadOnly(true);
+        m_words->setPlaceholderText(QString("%1 words from %2").arg(lexicon->Count()).arg(fileName));
+        return;
+    }
+
+    m_lexicon = lexicon;
+    UseLexiconText();
+}
+
+// Moves the words from m_lexicon into m_words, so they can be edited
+void Window::UseLexiconText()
+{
+    if (!m_lexicon) return;
 
     QStringList words;
-    while (!in.atEnd()) words.append(in.readLine());
+    for (int i = 0; i < m_lexicon->Count(); i++) words.append(m_lexicon->Line(i));
+    m_lexicon.clear();
 
+    m_words->setReadOnly(false);
+    m_words->setPlaceholderText("");
     m_words->setPlainText(words.join('\n'));
-
-    file.close();
 }
 
 void Window::SaveEsc()
@@ -498,6 +562,17 @@ void Window::SaveLex()
         return;
     }
 
+    if (m_lexicon)
+    {
+        for (int i = 0; i < m_lexicon->Count(); i++)
+        {
+            file.write(m_lexicon->LineView(i));
+            file.write("\n");
+        }
+        file.close();
+        return;
+    }
+
     QTextStream out(&file);
     out.setCodec("UTF-8");
     for (QString word : m_words->toPlainText().split('\n'))
@@ -2,13 +2,20 @@
 #define WINDOW_H
 
 #include <QMainWindow>
+#include <QVector>
+#include <QStringList>
+#include <QSharedPointer>
 #include "affixerdialog.h"
+#include "engine.h"
+#include "trace.h"
+#include "checkpoints.h"
+#include "rewriter.h"
 
 class QHBoxLayout;
 class QVBoxLayout;
 class QGroupBox;
 class QPlainTextEdit;
-class QTextEdit;
+class QListView;
 class QLabel;
 class QLineEdit;
 class QPushButton;
@@ -19,7 +26,11 @@ class QCheckBox;
 class QMenu;
 class QRadioButton;
 class QProgressBar;
+class QSpinBox;
 class Highlighter;
+class EngineThread;
+class LexiconFile;
+class ResultModel;
 
 template <class Key, class T> class QMap;
 
@@ -30,6 +41,7 @@ class Window : public QMainWindow
     Q_OBJECT
 public:
     explicit Window();
+    ~Window();
 
 private:
     QHBoxLayout *m_layout;
@@ -39,6 +51,8 @@ private:
     QVBoxLayout *m_midlayout;
     QVBoxLayout *m_resultslayout;
     QHBoxLayout *m_syllableseperatorlayout;
+    QHBoxLayout *m_seedlayout;
+    QHBoxLayout *m_branchlimitlayout;
 
     QLabel *m_categorieslabel;
     QPlainTextEdit *m_categories;
@@ -50,11 +64,17 @@ private:
     QPlainTextEdit *m_words;
     QLabel *m_applyfillerlabel;
     QPushButton *m_apply;
+    QPushButton *m_cancel;
     QLineEdit *m_syllabify;
     QLineEdit *m_syllableseperator;
     QLabel *m_syllableseperatorlabel;
+    QLineEdit *m_seed;
+    QLabel *m_seedlabel;
+    QSpinBox *m_branchlimit;
+    QLabel *m_branchlimitlabel;
     QLabel *m_resultslabel;
-    QTextEdit *m_results;
+    QListView *m_results;
+    ResultModel *m_resultmodel;
 
     QCheckBox *m_showChangedWords;
     QCheckBox *m_reportChanges;
@@ -78,9 +98,21 @@ private:
     Highlighter *m_highlighter;
 
     QMap<QChar, QList<QChar>> *m_categorieslist;
+    QString m_validCategories;         // the rewritten text m_categorieslist was last parsed from
+
+    EngineThread *m_run = nullptr;     // the run in progress, if there is one
+    QSharedPointer<LexiconFile> m_lexicon;     // a lexicon too big to show in m_words, which is used instead of it
+    QSharedPointer<Trace> m_trace;     // which rules applied in the current run, if they are being reported
+    QSharedPointer<Checkpoints> m_checkpoints;     // the words part way through the last run, so editing a rule only reruns the rules from it
+    Rewriter m_rewriter;
+    Rewriter m_rewriterBackwards;
+    QStringList m_truncatedWords;
+    int m_branchLimitUsed = 0;
 
     QString ApplyRewrite(QString str, bool backwards = false);
-    QString FormatOutput(QString in, QString out, QString gloss, bool isGloss);
+    Engine::Format CurrentFormat();
+    PhonemeInventory CurrentPhonemes();
+    void UseLexiconText();
 
     QMenu *fileMenu;
     QMenu *toolsMenu;
@@ -88,8 +120,14 @@ private:
 
 private slots:
     void DoSoundChanges();
+    void CancelSoundChanges();
+    void ShowResults(int first, QVector<Engine::Result> results);
+    void FinishSoundChanges(bool cancelled);
+    void UpdateFormat();
+    void CopyResults();
     void FilterCurrent();
     void UpdateCategories();
+    void UpdateRewrites();
     void AddFromAffixer(QStringList words, AffixerDialog::PlaceToAdd placeToAdd);
 
     void OpenEsc();
@@ -98,6 +136,7 @@ private slots:
     void SaveEscAs();
     void SaveLex();
     void RealOpenEsc(QString fileName);
+    void RealOpenLex(QString fileName);
     void RealSaveEsc(QString fileName);
 
     void LaunchAffixer();